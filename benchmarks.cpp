@@ -0,0 +1,417 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <optimizer.hpp>
+#include <session.hpp>
+#include <svgexporter.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Every benchmark is run as a number of samples, each of which repeats
+// the operation enough times to last at least the minimum sample time.
+// The median and the median absolute deviation are reported as they are
+// not thrown off by the occasional descheduled sample.
+
+namespace {
+
+volatile double sink; // Keeps results alive.
+
+struct BenchSettings {
+    int samples = 15;
+    double min_sample_time = 0.02; // Seconds.
+    const char *filter = nullptr;
+};
+
+struct BenchResult {
+    std::string name;
+    int samples;
+    long long iterations; // Per sample.
+    double median_ns, mad_ns, min_ns, mean_ns, max_ns; // Per iteration.
+    double items_per_iteration;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double median_of(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    const size_t n = v.size();
+    return n % 2 ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+double time_iterations(const std::function<void()> &f, long long iterations) {
+    const auto start = std::chrono::steady_clock::now();
+    for(long long i = 0; i < iterations; ++i) {
+        f();
+    }
+    return seconds_since(start);
+}
+
+class BenchRunner final {
+public:
+    explicit BenchRunner(const BenchSettings &settings) : settings(settings) {}
+
+    // items_per_iteration gives a throughput figure, e.g. tokens per run.
+    void run(const char *name, const std::function<void()> &f, double items_per_iteration = 0) {
+        if(settings.filter && !strstr(name, settings.filter)) {
+            return;
+        }
+        fprintf(stderr, "Running %s.\n", name);
+        // Warm up and find how many iterations fill a sample.
+        long long iterations = 1;
+        while(true) {
+            const double t = time_iterations(f, iterations);
+            if(t >= settings.min_sample_time || iterations >= (1LL << 40)) {
+                break;
+            }
+            const double scale = t > 0 ? 1.5 * settings.min_sample_time / t : 100.0;
+            iterations = std::max(iterations + 1, (long long)(iterations * std::min(scale, 100.0)));
+        }
+        std::vector<double> per_iteration;
+        for(int i = 0; i < settings.samples; ++i) {
+            per_iteration.push_back(time_iterations(f, iterations) * 1e9 / iterations);
+        }
+        BenchResult r;
+        r.name = name;
+        r.samples = settings.samples;
+        r.iterations = iterations;
+        r.median_ns = median_of(per_iteration);
+        std::vector<double> deviations;
+        for(const auto t : per_iteration) {
+            deviations.push_back(fabs(t - r.median_ns));
+        }
+        r.mad_ns = median_of(deviations);
+        r.min_ns = *std::min_element(per_iteration.begin(), per_iteration.end());
+        r.max_ns = *std::max_element(per_iteration.begin(), per_iteration.end());
+        double sum = 0;
+        for(const auto t : per_iteration) {
+            sum += t;
+        }
+        r.mean_ns = sum / per_iteration.size();
+        r.items_per_iteration = items_per_iteration;
+        results.push_back(r);
+    }
+
+    std::string to_json() const {
+        std::string json("{\n  \"context\": {\"compiler\": \"");
+#if defined(__VERSION__)
+        json += __VERSION__;
+#endif
+        json += "\"},\n  \"benchmarks\": [\n";
+        char buf[1024];
+        for(size_t i = 0; i < results.size(); ++i) {
+            const auto &r = results[i];
+            snprintf(buf,
+                     sizeof(buf),
+                     "    {\"name\": \"%s\", \"samples\": %d, \"iterations\": %lld, "
+                     "\"median_ns\": %.1f, \"mad_ns\": %.1f, \"min_ns\": %.1f, "
+                     "\"mean_ns\": %.1f, \"max_ns\": %.1f",
+                     r.name.c_str(),
+                     r.samples,
+                     r.iterations,
+                     r.median_ns,
+                     r.mad_ns,
+                     r.min_ns,
+                     r.mean_ns,
+                     r.max_ns);
+            json += buf;
+            if(r.items_per_iteration > 0) {
+                snprintf(buf,
+                         sizeof(buf),
+                         ", \"items_per_second\": %.1f",
+                         r.items_per_iteration * 1e9 / r.median_ns);
+                json += buf;
+            }
+            json += i + 1 < results.size() ? "},\n" : "}\n";
+        }
+        json += "  ]\n}\n";
+        return json;
+    }
+
+private:
+    BenchSettings settings;
+    std::vector<BenchResult> results;
+};
+
+std::string read_file(const char *fname) {
+    FILE *f = fopen(fname, "r");
+    if(!f) {
+        return std::string();
+    }
+    std::string result;
+    char buf[4096];
+    size_t num_read;
+    while((num_read = fread(buf, 1, sizeof(buf), f)) > 0) {
+        result.append(buf, num_read);
+    }
+    fclose(f);
+    return result;
+}
+
+void bezier_benchmarks(BenchRunner &runner) {
+    const Bezier b(Point(0.1, 0.2), Point(0.3, 0.9), Point(0.7, 0.8), Point(0.9, 0.1));
+    const int num_points = 100;
+    runner.run("bezier_evaluate",
+               [&b]() {
+                   double acc = 0;
+                   for(int i = 0; i < num_points; ++i) {
+                       acc += b.evaluate(i / double(num_points)).x();
+                   }
+                   sink = acc;
+               },
+               num_points);
+    runner.run("bezier_evaluate_d1",
+               [&b]() {
+                   double acc = 0;
+                   for(int i = 0; i < num_points; ++i) {
+                       acc += b.evaluate_d1(i / double(num_points)).x();
+                   }
+                   sink = acc;
+               },
+               num_points);
+    runner.run("bezier_evaluate_d2",
+               [&b]() {
+                   double acc = 0;
+                   for(int i = 0; i < num_points; ++i) {
+                       acc += b.evaluate_d2(i / double(num_points)).x();
+                   }
+                   sink = acc;
+               },
+               num_points);
+}
+
+// A skeleton like the one of es.fdef: fixed on-curve points and smooth
+// joins, with all control points free to move.
+std::unique_ptr<Stroke> wavy_stroke(int num_beziers) {
+    auto s = std::make_unique<Stroke>(num_beziers);
+    for(int i = 0; i <= num_beziers; ++i) {
+        const double y = 0.5 + (i % 2 ? 0.2 : -0.2);
+        s->add_constraint(std::make_unique<FixedConstraint>(3 * i, Point(i / double(num_beziers), y)));
+    }
+    for(int i = 1; i < num_beziers; ++i) {
+        s->add_constraint(std::make_unique<SmoothConstraint>(3 * i - 1, 3 * i + 1, 3 * i));
+    }
+    s->freeze();
+    return s;
+}
+
+void stroke_benchmarks(BenchRunner &runner) {
+    for(const int num_beziers : {6, 32}) {
+        auto stroke = wavy_stroke(num_beziers);
+        auto x1 = stroke->get_free_variables();
+        for(size_t i = 0; i < x1.size(); ++i) {
+            x1[i] += 0.01 * (i % 5);
+        }
+        auto x2 = x1;
+        for(auto &v : x2) {
+            v += 0.001;
+        }
+        // Alternates so that every segment is dirty on every call.
+        bool flip = false;
+        std::string name = "stroke_curvature_full_" + std::to_string(num_beziers);
+        runner.run(name.c_str(), [&]() {
+            flip = !flip;
+            sink = stroke->calculate_value_for(flip ? x1 : x2);
+        });
+        stroke->calculate_value_for(x1);
+        name = "stroke_curvature_one_variable_" + std::to_string(num_beziers);
+        size_t var = 0;
+        runner.run(name.c_str(), [&]() {
+            var = (var + 1) % x1.size();
+            sink = stroke->calculate_value_with(x1, var, x1[var] + 1e-6);
+        });
+    }
+}
+
+void parser_benchmarks(BenchRunner &runner, const std::string &program) {
+    int num_tokens = 0;
+    {
+        Lexer l(program);
+        while(l.next().type != TokenType::eof) {
+            ++num_tokens;
+        }
+    }
+    runner.run("lexer_next",
+               [&program]() {
+                   Lexer l(program);
+                   int count = 0;
+                   while(l.next().type != TokenType::eof) {
+                       ++count;
+                   }
+                   sink = count;
+               },
+               num_tokens);
+    runner.run("parse", [&program]() {
+        Lexer l(program);
+        Parser p(l);
+        sink = p.parse();
+    });
+    Lexer l(program);
+    Parser p(l);
+    if(!p.parse()) {
+        fprintf(stderr, "Parse error: %s\n", p.get_error().c_str());
+        return;
+    }
+    runner.run("interpret", [&p]() {
+        Bridge b;
+        Interpreter i(p, &b);
+        sink = i.execute_program();
+    });
+}
+
+void optimization_benchmarks(BenchRunner &runner, const std::string &program) {
+    runner.run("optimize_es", [&program]() {
+        OptimizerState state;
+        state.verbose = false;
+        state.num_threads = 1;
+        auto result = calculate_sample_dynamically(state, program);
+        sink = state.frames.size();
+    });
+    // Without the animation frames, which take most of the time above, to
+    // compare sampling schedules of the skeleton objective.
+    auto run_schedule = [&runner, &program](const char *name, const std::vector<int> &strides) {
+        runner.run(name, [&program, &strides]() {
+            OptimizerState state;
+            state.verbose = false;
+            state.keep_frames = false;
+            state.num_threads = 1;
+            state.sample_strides = strides;
+            auto result = calculate_sample_dynamically(state, program);
+            sink = std::holds_alternative<Glyph>(result);
+        });
+    };
+    run_schedule("optimize_es_all_samples", {});
+    run_schedule("optimize_es_coarse_to_fine", {8, 1});
+    OptimizerState state;
+    state.verbose = false;
+    auto result = calculate_sample_dynamically(state, program);
+    if(std::holds_alternative<std::string>(result)) {
+        fprintf(stderr, "%s\n", std::get<std::string>(result).c_str());
+        return;
+    }
+    auto &glyph = std::get<Glyph>(result);
+    SvgExporter svg;
+    for(auto &s : glyph.strokes) {
+        build_svg(s, svg, OptPhase::finished);
+    }
+    runner.run("svg_to_string", [&svg]() { sink = svg.to_string().size(); });
+}
+
+// An editor changing one line back and forth.
+void session_benchmarks(BenchRunner &runner, const std::string &program) {
+    const auto pos = program.find("w = 0.7\n");
+    if(pos == std::string::npos) {
+        fprintf(stderr, "Program has no line w = 0.7, skipping session benchmarks.\n");
+        return;
+    }
+    std::string edited(program);
+    edited.replace(pos, 7, "w = 0.72");
+    std::string restructured(program);
+    restructured.replace(pos, 7, "w = 0.7 * 1");
+    IncrementalProgram incremental;
+    incremental.update(program);
+    bool flip = false;
+    runner.run("frontend_line_edit", [&]() {
+        flip = !flip;
+        incremental.update(flip ? restructured : program);
+        Bridge b;
+        sink = incremental.execute(&b).has_value();
+    });
+    Session session;
+    session.update(program);
+    runner.run("session_number_edit", [&]() {
+        flip = !flip;
+        sink = session.update(flip ? edited : program).seconds;
+    });
+    runner.run("session_number_edit_16ms", [&]() {
+        flip = !flip;
+        sink = session.update(flip ? edited : program, 16).seconds;
+    });
+}
+
+void print_usage(const char *progname) {
+    printf("%s [options] <es.fdef>\n\n", progname);
+    printf("  --filter=name     only run benchmarks whose name contains this\n");
+    printf("  --samples=15      samples per benchmark\n");
+    printf("  --min-time=20     minimum sample length in milliseconds\n");
+    printf("  --json=out.json   write the results here instead of stdout\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    BenchSettings settings;
+    const char *json_file = nullptr;
+    const char *program_file = nullptr;
+    for(int i = 1; i < argc; ++i) {
+        if(strncmp(argv[i], "--filter=", 9) == 0) {
+            settings.filter = argv[i] + 9;
+        } else if(strncmp(argv[i], "--samples=", 10) == 0) {
+            settings.samples = atoi(argv[i] + 10);
+        } else if(strncmp(argv[i], "--min-time=", 11) == 0) {
+            settings.min_sample_time = atof(argv[i] + 11) / 1000.0;
+        } else if(strncmp(argv[i], "--json=", 7) == 0) {
+            json_file = argv[i] + 7;
+        } else if(argv[i][0] != '-' && !program_file) {
+            program_file = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if(!program_file || settings.samples < 1 || settings.min_sample_time < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    const std::string program = read_file(program_file);
+    if(program.empty()) {
+        printf("Could not read %s.\n", program_file);
+        return 1;
+    }
+
+    BenchRunner runner(settings);
+    bezier_benchmarks(runner);
+    stroke_benchmarks(runner);
+    parser_benchmarks(runner, program);
+    optimization_benchmarks(runner, program);
+    session_benchmarks(runner, program);
+
+    const auto json = runner.to_json();
+    if(!json_file) {
+        printf("%s", json.c_str());
+        return 0;
+    }
+    FILE *f = fopen(json_file, "w");
+    if(!f || fwrite(json.data(), 1, json.size(), f) != json.size()) {
+        printf("Could not write %s.\n", json_file);
+        if(f) {
+            fclose(f);
+        }
+        return 1;
+    }
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <server.hpp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+// Sends one program to a fonttoy server and prints the answer.
+
+std::string read_file(const char *fname) {
+    FILE *f = fopen(fname, "r");
+    if(!f) {
+        return std::string();
+    }
+    std::string result;
+    char buf[4096];
+    size_t num_read;
+    while((num_read = fread(buf, 1, sizeof(buf), f)) > 0) {
+        result.append(buf, num_read);
+    }
+    fclose(f);
+    return result;
+}
+
+void print_usage(const char *progname) {
+    printf("%s --socket=path [server options] <input file>\n\n", progname);
+    printf("Server options are passed on as is, e.g. output=variables deadline=50.\n");
+    printf("Exits with 0 for a full result, 2 for a partial one and 1 on errors.\n");
+}
+
+int main(int argc, char **argv) {
+    const char *socket_path = nullptr;
+    const char *infile = nullptr;
+    std::string options;
+    for(int i = 1; i < argc; ++i) {
+        if(strncmp(argv[i], "--socket=", 9) == 0) {
+            socket_path = argv[i] + 9;
+        } else if(argv[i][0] != '-' && strchr(argv[i], '=')) {
+            options += options.empty() ? "" : " ";
+            options += argv[i];
+        } else if(argv[i][0] != '-' && !infile) {
+            infile = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if(!socket_path || !infile) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    const auto program = read_file(infile);
+    if(program.empty()) {
+        printf("Could not read %s.\n", infile);
+        return 1;
+    }
+    const int fd = connect_unix_socket(socket_path);
+    if(fd < 0) {
+        printf("Could not connect to %s.\n", socket_path);
+        return 1;
+    }
+    FILE *in = fdopen(fd, "r");
+    FILE *out = fdopen(dup(fd), "w");
+    if(!in || !out || !write_message(out, options + "\n" + program)) {
+        printf("Could not send the request.\n");
+        return 1;
+    }
+    const auto response = read_message(in);
+    fclose(out);
+    fclose(in);
+    if(!response) {
+        printf("No response from the server.\n");
+        return 1;
+    }
+    const auto line_end = response->find('\n');
+    const std::string status = response->substr(0, line_end);
+    if(line_end != std::string::npos) {
+        fwrite(response->data() + line_end + 1, 1, response->size() - line_end - 1, stdout);
+    }
+    if(status == "error") {
+        printf("\n");
+        return 1;
+    }
+    return status == "partial" ? 2 : 0;
+}
@@ -15,9 +15,24 @@
   along with this program; if not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifndef _USE_MATH_DEFINES
+#define _USE_MATH_DEFINES
+#endif
+
 #include <constraints.hpp>
+#include <stats.hpp>
 #include <cmath>
 #include <cassert>
+#include <algorithm>
+
+// Also used for the axis of ReflectConstraint.
+static Point reflect_across(const Point &p, const Point &axis_point, double axis_angle) {
+    const Vector axis(cos(axis_angle), sin(axis_angle));
+    const Vector offset = p - axis_point;
+    return axis_point + axis * (2.0 * offset.dot(axis)) - offset;
+}
+
+Point Reflection::apply(const Point &p) const { return reflect_across(p, axis_point, axis_angle); }
 
 int FixedConstraint::num_free_variables() const { return 0; }
 
@@ -27,7 +42,10 @@ int FixedConstraint::put_free_variables_in(std::vector<double> &, const int) con
 
 int FixedConstraint::get_free_variables_from(const std::vector<double> &, const int) { return 0; }
 
-void FixedConstraint::update_model(std::vector<Point> &points) const { points[point_index] = p; }
+void FixedConstraint::update_model(std::vector<Point> &points) const {
+    STAT_COUNT(fixed_constraint);
+    points[point_index] = p;
+}
 
 std::vector<CoordinateDefinition> FixedConstraint::determines_points() const {
     std::vector<CoordinateDefinition> v;
@@ -40,6 +58,55 @@ std::vector<VariableLimits> FixedConstraint::get_limits() const {
     return v;
 }
 
+void FixedConstraint::fit_to(const std::vector<Point> &) {}
+
+void FixedConstraint::append_parameters_to(std::vector<double> &parameters) const {
+    parameters.push_back(p.x());
+    parameters.push_back(p.y());
+}
+
+std::unique_ptr<Constraint> FixedConstraint::reflected(const Reflection &r) const {
+    return std::make_unique<FixedConstraint>(r.map(point_index), r.apply(p));
+}
+
+int AttachConstraint::num_free_variables() const { return 0; }
+
+void AttachConstraint::append_free_variables_to(std::vector<double> &) const {}
+
+int AttachConstraint::put_free_variables_in(std::vector<double> &, const int) const { return 0; }
+
+int AttachConstraint::get_free_variables_from(const std::vector<double> &, const int) { return 0; }
+
+void AttachConstraint::update_model(std::vector<Point> &points) const {
+    STAT_COUNT(attach_constraint);
+    points[point_index] = p;
+}
+
+std::vector<CoordinateDefinition> AttachConstraint::determines_points() const {
+    std::vector<CoordinateDefinition> v;
+    v.emplace_back(point_index, true, true);
+    return v;
+}
+
+std::vector<VariableLimits> AttachConstraint::get_limits() const {
+    std::vector<VariableLimits> v;
+    return v;
+}
+
+void AttachConstraint::fit_to(const std::vector<Point> &) {}
+
+void AttachConstraint::append_parameters_to(std::vector<double> &parameters) const {
+    parameters.push_back(p.x());
+    parameters.push_back(p.y());
+}
+
+std::unique_ptr<Constraint> AttachConstraint::reflected(const Reflection &r) const {
+    auto c =
+        std::make_unique<AttachConstraint>(r.map(point_index), other_stroke, other_point_index);
+    c->p = r.apply(p);
+    return c;
+}
+
 int FreeConstraint::num_free_variables() const { return 2; }
 
 void FreeConstraint::append_free_variables_to(std::vector<double> &variables) const {
@@ -59,7 +126,10 @@ int FreeConstraint::get_free_variables_from(const std::vector<double> &variables
     return 2;
 }
 
-void FreeConstraint::update_model(std::vector<Point> &points) const { points[point_index] = p; }
+void FreeConstraint::update_model(std::vector<Point> &points) const {
+    STAT_COUNT(free_constraint);
+    points[point_index] = p;
+}
 
 std::vector<CoordinateDefinition> FreeConstraint::determines_points() const {
     std::vector<CoordinateDefinition> r;
@@ -76,6 +146,14 @@ std::vector<VariableLimits> FreeConstraint::get_limits() const {
     return result;
 }
 
+void FreeConstraint::fit_to(const std::vector<Point> &points) { p = points[point_index]; }
+
+void FreeConstraint::append_parameters_to(std::vector<double> &) const {}
+
+std::unique_ptr<Constraint> FreeConstraint::reflected(const Reflection &r) const {
+    return std::make_unique<FreeConstraint>(r.map(point_index), r.apply(p));
+}
+
 DirectionConstraint::DirectionConstraint(int from_point_index, int to_point_index, double angle)
     : from_point_index(from_point_index), to_point_index(to_point_index), angle(angle) {
     distance = 0.2;
@@ -100,6 +178,7 @@ int DirectionConstraint::get_free_variables_from(const std::vector<double> &vari
 }
 
 void DirectionConstraint::update_model(std::vector<Point> &points) const {
+    STAT_COUNT(direction_constraint);
     Vector direction_unit_vector(cos(angle), sin(angle));
     points[to_point_index] = points[from_point_index] + distance * direction_unit_vector;
 }
@@ -117,6 +196,23 @@ std::vector<VariableLimits> DirectionConstraint::get_limits() const {
     return v;
 }
 
+void DirectionConstraint::fit_to(const std::vector<Point> &points) {
+    Vector direction_unit_vector(cos(angle), sin(angle));
+    Vector offset = points[to_point_index] - points[from_point_index];
+    distance = std::max(0.0, offset.dot(direction_unit_vector));
+}
+
+void DirectionConstraint::append_parameters_to(std::vector<double> &parameters) const {
+    parameters.push_back(angle);
+}
+
+std::unique_ptr<Constraint> DirectionConstraint::reflected(const Reflection &r) const {
+    auto c = std::make_unique<DirectionConstraint>(
+        r.map(from_point_index), r.map(to_point_index), r.apply_angle(angle));
+    c->distance = distance;
+    return c;
+}
+
 MirrorConstraint::MirrorConstraint(int point_index, int from_point_index, int mirror_point_index)
     : point_index(point_index), from_point_index(from_point_index),
       mirror_point_index(mirror_point_index) {}
@@ -130,6 +226,7 @@ int MirrorConstraint::put_free_variables_in(std::vector<double> &, const int) co
 int MirrorConstraint::get_free_variables_from(const std::vector<double> &, const int) { return 0; }
 
 void MirrorConstraint::update_model(std::vector<Point> &points) const {
+    STAT_COUNT(mirror_constraint);
     Vector updated_location(Vector(points[mirror_point_index]) * 2.0 -
                             Vector(points[from_point_index]));
     points[point_index] = Point(updated_location.x(), updated_location.y());
@@ -146,6 +243,15 @@ std::vector<VariableLimits> MirrorConstraint::get_limits() const {
     return l;
 }
 
+void MirrorConstraint::fit_to(const std::vector<Point> &) {}
+
+void MirrorConstraint::append_parameters_to(std::vector<double> &) const {}
+
+std::unique_ptr<Constraint> MirrorConstraint::reflected(const Reflection &r) const {
+    return std::make_unique<MirrorConstraint>(
+        r.map(point_index), r.map(from_point_index), r.map(mirror_point_index));
+}
+
 SmoothConstraint::SmoothConstraint(int this_control_index,
                                    int other_control_index,
                                    int curve_point_index)
@@ -173,6 +279,7 @@ int SmoothConstraint::get_free_variables_from(const std::vector<double> &variabl
 }
 
 void SmoothConstraint::update_model(std::vector<Point> &points) const {
+    STAT_COUNT(smooth_constraint);
     Vector delta = points[other_control_index] - points[curve_point_index];
     points[this_control_index] = points[curve_point_index] - delta * alpha;
 }
@@ -190,6 +297,24 @@ std::vector<VariableLimits> SmoothConstraint::get_limits() const {
     return result;
 }
 
+void SmoothConstraint::fit_to(const std::vector<Point> &points) {
+    Vector delta = points[other_control_index] - points[curve_point_index];
+    if(delta.is_numerically_zero()) {
+        return;
+    }
+    Vector wanted = points[curve_point_index] - points[this_control_index];
+    alpha = std::max(0.01, wanted.dot(delta) / delta.dot(delta));
+}
+
+void SmoothConstraint::append_parameters_to(std::vector<double> &) const {}
+
+std::unique_ptr<Constraint> SmoothConstraint::reflected(const Reflection &r) const {
+    auto c = std::make_unique<SmoothConstraint>(
+        r.map(this_control_index), r.map(other_control_index), r.map(curve_point_index));
+    c->alpha = alpha;
+    return c;
+}
+
 AngleConstraint::AngleConstraint(int point_index,
                                  int from_point_index,
                                  double min_angle,
@@ -222,6 +347,7 @@ int AngleConstraint::get_free_variables_from(const std::vector<double> &variable
 }
 
 void AngleConstraint::update_model(std::vector<Point> &points) const {
+    STAT_COUNT(angle_constraint);
     Vector direction_unit_vector = Vector(cos(angle), sin(angle));
     points[point_index] = points[from_point_index] + direction_unit_vector * distance;
 }
@@ -241,6 +367,35 @@ std::vector<VariableLimits> AngleConstraint::get_limits() const {
     return result;
 }
 
+void AngleConstraint::fit_to(const std::vector<Point> &points) {
+    Vector offset = points[point_index] - points[from_point_index];
+    if(offset.is_numerically_zero()) {
+        return;
+    }
+    // Bring the direction to the turn closest to the allowed range.
+    const double middle = (min_angle + max_angle) / 2.0;
+    double a = offset.angle();
+    a += 2.0 * M_PI * round((middle - a) / (2.0 * M_PI));
+    angle = std::clamp(a, min_angle, max_angle);
+    distance = offset.length();
+}
+
+void AngleConstraint::append_parameters_to(std::vector<double> &parameters) const {
+    parameters.push_back(min_angle);
+    parameters.push_back(max_angle);
+}
+
+std::unique_ptr<Constraint> AngleConstraint::reflected(const Reflection &r) const {
+    // Reflecting turns the range around.
+    auto c = std::make_unique<AngleConstraint>(r.map(point_index),
+                                               r.map(from_point_index),
+                                               r.apply_angle(max_angle),
+                                               r.apply_angle(min_angle));
+    c->angle = r.apply_angle(angle);
+    c->distance = distance;
+    return c;
+}
+
 SameOffsetConstraint::SameOffsetConstraint(int point_index,
                                            int relative_to_index,
                                            int other_point_index,
@@ -261,6 +416,7 @@ int SameOffsetConstraint::get_free_variables_from(const std::vector<double> &, c
 }
 
 void SameOffsetConstraint::update_model(std::vector<Point> &points) const {
+    STAT_COUNT(same_offset_constraint);
     auto delta = points[other_point_index] - points[other_relative_to_index];
     points[point_index] = points[relative_to_index] + delta;
 }
@@ -275,3 +431,53 @@ std::vector<VariableLimits> SameOffsetConstraint::get_limits() const {
     std::vector<VariableLimits> result;
     return result;
 }
+
+void SameOffsetConstraint::fit_to(const std::vector<Point> &) {}
+
+void SameOffsetConstraint::append_parameters_to(std::vector<double> &) const {}
+
+std::unique_ptr<Constraint> SameOffsetConstraint::reflected(const Reflection &r) const {
+    return std::make_unique<SameOffsetConstraint>(r.map(point_index),
+                                                  r.map(relative_to_index),
+                                                  r.map(other_point_index),
+                                                  r.map(other_relative_to_index));
+}
+
+int ReflectConstraint::num_free_variables() const { return 0; }
+
+void ReflectConstraint::append_free_variables_to(std::vector<double> &) const {}
+
+int ReflectConstraint::put_free_variables_in(std::vector<double> &, const int) const { return 0; }
+
+int ReflectConstraint::get_free_variables_from(const std::vector<double> &, const int) { return 0; }
+
+void ReflectConstraint::update_model(std::vector<Point> &points) const {
+    STAT_COUNT(reflect_constraint);
+    points[point_index] = reflect_across(points[from_point_index], axis_point, axis_angle);
+}
+
+std::vector<CoordinateDefinition> ReflectConstraint::determines_points() const {
+    std::vector<CoordinateDefinition> result;
+    result.emplace_back(point_index, true, true);
+    return result;
+}
+
+std::vector<VariableLimits> ReflectConstraint::get_limits() const {
+    std::vector<VariableLimits> result;
+    return result;
+}
+
+void ReflectConstraint::fit_to(const std::vector<Point> &) {}
+
+void ReflectConstraint::append_parameters_to(std::vector<double> &parameters) const {
+    parameters.push_back(axis_point.x());
+    parameters.push_back(axis_point.y());
+    parameters.push_back(axis_angle);
+}
+
+std::unique_ptr<Constraint> ReflectConstraint::reflected(const Reflection &r) const {
+    return std::make_unique<ReflectConstraint>(r.map(point_index),
+                                               r.map(from_point_index),
+                                               r.apply(axis_point),
+                                               r.apply_angle(axis_angle));
+}
@@ -19,6 +19,7 @@
 
 #include <maths.hpp>
 #include <vector>
+#include <memory>
 #include <optional>
 
 struct VariableLimits {
@@ -54,6 +55,18 @@ struct CoordinateDefinition {
         : index(index), w(defines_x, defines_y) {}
 };
 
+// A reflection across the line through axis_point in the direction
+// axis_angle, with the points renumbered by point_map.
+struct Reflection {
+    Point axis_point;
+    double axis_angle;
+    std::vector<int> point_map;
+
+    Point apply(const Point &p) const;
+    double apply_angle(double angle) const { return 2.0 * axis_angle - angle; }
+    int map(int point_index) const { return point_map[point_index]; }
+};
+
 class Constraint {
 public:
     virtual ~Constraint() = default;
@@ -65,6 +78,14 @@ public:
     virtual void update_model(std::vector<Point> &points) const = 0;
     virtual std::vector<CoordinateDefinition> determines_points() const = 0;
     virtual std::vector<VariableLimits> get_limits() const = 0;
+    // Set free variables so that update_model reproduces the given
+    // points as closely as the constraint allows.
+    virtual void fit_to(const std::vector<Point> &points) = 0;
+    // The values set by the program that are not free variables.
+    virtual void append_parameters_to(std::vector<double> &parameters) const = 0;
+    // The same constraint for the reflected points. Its free variables
+    // describe the reflection of the current ones.
+    virtual std::unique_ptr<Constraint> reflected(const Reflection &r) const = 0;
 };
 
 class FixedConstraint final : public Constraint {
@@ -79,12 +100,49 @@ public:
     void update_model(std::vector<Point> &points) const override;
     std::vector<CoordinateDefinition> determines_points() const override;
     std::vector<VariableLimits> get_limits() const override;
+    void fit_to(const std::vector<Point> &points) override;
+    void append_parameters_to(std::vector<double> &parameters) const override;
+    std::unique_ptr<Constraint> reflected(const Reflection &r) const override;
+
+    int get_point_index() const { return point_index; }
+    const Point &get_point() const { return p; }
 
 private:
     int point_index;
     Point p;
 };
 
+// Pins a point to a point of another stroke. The location is only known
+// once the other stroke has been solved, see Stroke::attach_to.
+class AttachConstraint final : public Constraint {
+
+public:
+    AttachConstraint(int point_index, int other_stroke, int other_point_index)
+        : point_index(point_index), other_stroke(other_stroke),
+          other_point_index(other_point_index) {}
+
+    int num_free_variables() const override;
+    void append_free_variables_to(std::vector<double> &variables) const override;
+    int put_free_variables_in(std::vector<double> &variables, const int offset) const override;
+    int get_free_variables_from(const std::vector<double> &variables, const int offset) override;
+    void update_model(std::vector<Point> &points) const override;
+    std::vector<CoordinateDefinition> determines_points() const override;
+    std::vector<VariableLimits> get_limits() const override;
+    void fit_to(const std::vector<Point> &points) override;
+    void append_parameters_to(std::vector<double> &parameters) const override;
+    std::unique_ptr<Constraint> reflected(const Reflection &r) const override;
+
+    int get_other_stroke() const { return other_stroke; }
+    int get_other_point_index() const { return other_point_index; }
+    void set_target(const Point &target) { p = target; }
+
+private:
+    int point_index;
+    int other_stroke;
+    int other_point_index;
+    Point p;
+};
+
 class FreeConstraint final : public Constraint {
 
 public:
@@ -98,6 +156,9 @@ public:
     void update_model(std::vector<Point> &points) const override;
     std::vector<CoordinateDefinition> determines_points() const override;
     std::vector<VariableLimits> get_limits() const override;
+    void fit_to(const std::vector<Point> &points) override;
+    void append_parameters_to(std::vector<double> &parameters) const override;
+    std::unique_ptr<Constraint> reflected(const Reflection &r) const override;
 
 private:
     int point_index;
@@ -116,6 +177,9 @@ public:
     void update_model(std::vector<Point> &points) const override;
     std::vector<CoordinateDefinition> determines_points() const override;
     std::vector<VariableLimits> get_limits() const override;
+    void fit_to(const std::vector<Point> &points) override;
+    void append_parameters_to(std::vector<double> &parameters) const override;
+    std::unique_ptr<Constraint> reflected(const Reflection &r) const override;
 
 private:
     int from_point_index;
@@ -136,6 +200,9 @@ public:
     void update_model(std::vector<Point> &points) const override;
     std::vector<CoordinateDefinition> determines_points() const override;
     std::vector<VariableLimits> get_limits() const override;
+    void fit_to(const std::vector<Point> &points) override;
+    void append_parameters_to(std::vector<double> &parameters) const override;
+    std::unique_ptr<Constraint> reflected(const Reflection &r) const override;
 
 private:
     int point_index;
@@ -155,6 +222,9 @@ public:
     void update_model(std::vector<Point> &points) const override;
     std::vector<CoordinateDefinition> determines_points() const override;
     std::vector<VariableLimits> get_limits() const override;
+    void fit_to(const std::vector<Point> &points) override;
+    void append_parameters_to(std::vector<double> &parameters) const override;
+    std::unique_ptr<Constraint> reflected(const Reflection &r) const override;
 
 private:
     int this_control_index, other_control_index, curve_point_index;
@@ -173,6 +243,9 @@ public:
     void update_model(std::vector<Point> &points) const override;
     std::vector<CoordinateDefinition> determines_points() const override;
     std::vector<VariableLimits> get_limits() const override;
+    void fit_to(const std::vector<Point> &points) override;
+    void append_parameters_to(std::vector<double> &parameters) const override;
+    std::unique_ptr<Constraint> reflected(const Reflection &r) const override;
 
 private:
     int point_index;
@@ -198,7 +271,37 @@ public:
     void update_model(std::vector<Point> &points) const override;
     std::vector<CoordinateDefinition> determines_points() const override;
     std::vector<VariableLimits> get_limits() const override;
+    void fit_to(const std::vector<Point> &points) override;
+    void append_parameters_to(std::vector<double> &parameters) const override;
+    std::unique_ptr<Constraint> reflected(const Reflection &r) const override;
 
 private:
     int point_index, relative_to_index, other_point_index, other_relative_to_index;
 };
+
+// Places a point at the mirror image of another one across a line. One
+// half of a symmetric stroke can be made out of these.
+class ReflectConstraint final : public Constraint {
+
+public:
+    ReflectConstraint(int point_index, int from_point_index, Point axis_point, double axis_angle)
+        : point_index(point_index), from_point_index(from_point_index), axis_point(axis_point),
+          axis_angle(axis_angle) {}
+
+    int num_free_variables() const override;
+    void append_free_variables_to(std::vector<double> &variables) const override;
+    int put_free_variables_in(std::vector<double> &variables, const int offset) const override;
+    int get_free_variables_from(const std::vector<double> &variables, const int offset) override;
+    void update_model(std::vector<Point> &points) const override;
+    std::vector<CoordinateDefinition> determines_points() const override;
+    std::vector<VariableLimits> get_limits() const override;
+    void fit_to(const std::vector<Point> &points) override;
+    void append_parameters_to(std::vector<double> &parameters) const override;
+    std::unique_ptr<Constraint> reflected(const Reflection &r) const override;
+
+private:
+    int point_index;
+    int from_point_index;
+    Point axis_point;
+    double axis_angle;
+};
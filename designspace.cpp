@@ -0,0 +1,171 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <designspace.hpp>
+#include <trace.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+std::variant<Glyph, std::string>
+solve(const Parser &p, const ProgramConstants &constants, OptimizerState &state) {
+    Bridge b;
+    b.set_constants(constants);
+    auto error = execute_parsed(p, b);
+    if(error) {
+        return *error;
+    }
+    optimize_program(state, b);
+    return std::move(b.get_glyph());
+}
+
+std::optional<std::string> check_compatible(const Glyph &a, const Glyph &b) {
+    if(a.strokes.size() != b.strokes.size()) {
+        return std::string("Masters have a different number of strokes.");
+    }
+    for(size_t i = 0; i < a.strokes.size(); ++i) {
+        const auto &sa = a.strokes[i];
+        const auto &sb = b.strokes[i];
+        if(sa.skeleton.structure_key() != sb.skeleton.structure_key() ||
+           sa.left.get_free_variables().size() != sb.left.get_free_variables().size() ||
+           sa.right.get_free_variables().size() != sb.right.get_free_variables().size()) {
+            return "Masters are not compatible, stroke " + std::to_string(i) +
+                   " has a different constraint structure.";
+        }
+    }
+    return std::optional<std::string>{};
+}
+
+std::vector<double> interpolate(const std::vector<double> &a, const std::vector<double> &b, double f) {
+    std::vector<double> result(a.size());
+    for(size_t i = 0; i < a.size(); ++i) {
+        result[i] = (1.0 - f) * a[i] + f * b[i];
+    }
+    return result;
+}
+
+std::vector<std::string> constant_names(const ProgramConstants &c) {
+    std::vector<std::string> names;
+    for(const auto &[name, value] : c) {
+        names.push_back(name);
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+double value_of(const ProgramConstants &c, const std::string &name) {
+    for(const auto &[n, value] : c) {
+        if(n == name) {
+            return value;
+        }
+    }
+    assert(false);
+    return 0.0;
+}
+
+} // namespace
+
+std::variant<std::vector<DesignInstance>, std::string>
+build_design_space(const std::string &program,
+                   const DesignSpaceSettings &settings,
+                   const OptimizerState &defaults) {
+    TraceSpan span("build_design_space");
+    const auto &masters = settings.masters;
+    if(masters.size() < 2) {
+        return std::string("At least two masters are needed.");
+    }
+    if(settings.num_instances < 2) {
+        return std::string("At least two instances are needed.");
+    }
+    for(const auto &m : masters) {
+        if(constant_names(m) != constant_names(masters.front())) {
+            return std::string("All masters must set the same constants.");
+        }
+    }
+    Lexer l(program);
+    Parser p(l);
+    if(!p.parse()) {
+        return "Parser fail: " + p.get_error();
+    }
+
+    std::vector<Glyph> solved;
+    for(const auto &m : masters) {
+        auto state = defaults.settings();
+        auto g = solve(p, m, state);
+        if(std::holds_alternative<std::string>(g)) {
+            return std::move(std::get<std::string>(g));
+        }
+        solved.push_back(std::move(std::get<Glyph>(g)));
+        auto error = check_compatible(solved.front(), solved.back());
+        if(error) {
+            return *error;
+        }
+    }
+    std::vector<std::vector<StrokeStart>> variables;
+    for(const auto &g : solved) {
+        variables.emplace_back();
+        for(const auto &s : g.strokes) {
+            variables.back().push_back(StrokeStart{s.skeleton.get_free_variables(),
+                                                   s.left.get_free_variables(),
+                                                   s.right.get_free_variables()});
+        }
+    }
+
+    // Instance k is at position k / (n - 1) * (masters - 1) along the
+    // masters, between master j and j + 1.
+    std::vector<DesignInstance> instances;
+    const auto names = constant_names(masters.front());
+    for(int k = 0; k < settings.num_instances; ++k) {
+        const double position = double(k) * (masters.size() - 1) / (settings.num_instances - 1);
+        const int j = std::min((int)position, (int)masters.size() - 2);
+        const double f = position - j;
+        ProgramConstants constants;
+        for(const auto &name : names) {
+            const double a = value_of(masters[j], name);
+            const double b = value_of(masters[j + 1], name);
+            constants.emplace_back(name, (1.0 - f) * a + f * b);
+        }
+        auto state = defaults.settings();
+        for(size_t s = 0; s < variables[j].size(); ++s) {
+            const auto &a = variables[j][s];
+            const auto &b = variables[j + 1][s];
+            state.starts.push_back(StrokeStart{interpolate(a.skeleton, b.skeleton, f),
+                                               interpolate(a.left, b.left, f),
+                                               interpolate(a.right, b.right, f)});
+        }
+        if(settings.polish) {
+            if(!state.stopping.max_evaluations) {
+                state.stopping.max_evaluations = settings.polish_evaluations;
+            }
+        } else {
+            state.start_only = true;
+        }
+        auto g = solve(p, constants, state);
+        if(std::holds_alternative<std::string>(g)) {
+            return std::move(std::get<std::string>(g));
+        }
+        auto error = check_compatible(solved.front(), std::get<Glyph>(g));
+        if(error) {
+            return "Instance " + std::to_string(k) + " is not compatible with the masters.";
+        }
+        instances.push_back(DesignInstance{std::move(constants), std::move(std::get<Glyph>(g))});
+    }
+    return instances;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <optimizer.hpp>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Builds the instances of a family, such as its weights, from a few
+// master instances. The masters are different values of top-level
+// constants of one program and are solved in full. The other instances
+// run the program with interpolated constants and take the free
+// variables of every stroke from the interpolation of the masters.
+// This requires masters that are compatible: the same strokes with the
+// same constraint structure, so that their variables correspond.
+
+struct DesignSpaceSettings {
+    std::vector<ProgramConstants> masters; // In order along the axis.
+    int num_instances = 9;
+    // Optimize every instance further, starting from the interpolation.
+    bool polish = false;
+    int polish_evaluations = 50; // Per phase, unless the state has a limit.
+};
+
+struct DesignInstance {
+    ProgramConstants constants;
+    Glyph glyph;
+};
+
+// Instances evenly spaced from the first master to the last. The state
+// gives the settings to optimize the masters and instances with.
+std::variant<std::vector<DesignInstance>, std::string>
+build_design_space(const std::string &program,
+                   const DesignSpaceSettings &settings,
+                   const OptimizerState &defaults);
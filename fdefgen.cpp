@@ -0,0 +1,78 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <generator.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+void print_usage(const char *progname) {
+    printf("%s [options] <number of beziers> [out.fdef]\n\n", progname);
+    printf("  --seed=1          random seed for the point heights\n");
+    printf("  --amplitude=0.3   wave amplitude in em\n");
+    printf("  --jitter=0.1      height variation relative to the amplitude\n");
+    printf("  --pen-radius=0.02 circular pen radius, 0 for none\n");
+}
+
+int main(int argc, char **argv) {
+    GeneratorSettings settings;
+    settings.num_beziers = 0;
+    const char *outfile = nullptr;
+    for(int i = 1; i < argc; ++i) {
+        if(strncmp(argv[i], "--seed=", 7) == 0) {
+            settings.seed = strtoul(argv[i] + 7, nullptr, 10);
+        } else if(strncmp(argv[i], "--amplitude=", 12) == 0) {
+            settings.amplitude = atof(argv[i] + 12);
+        } else if(strncmp(argv[i], "--jitter=", 9) == 0) {
+            settings.jitter = atof(argv[i] + 9);
+        } else if(strncmp(argv[i], "--pen-radius=", 13) == 0) {
+            settings.pen_radius = atof(argv[i] + 13);
+        } else if(argv[i][0] != '-' && settings.num_beziers == 0) {
+            settings.num_beziers = atoi(argv[i]);
+            if(settings.num_beziers <= 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if(argv[i][0] != '-' && !outfile) {
+            outfile = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if(settings.num_beziers <= 0 || settings.amplitude < 0 || settings.amplitude > 0.5 ||
+       settings.jitter < 0 || settings.pen_radius < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    const auto program = generate_fdef(settings);
+    if(!outfile) {
+        printf("%s", program.c_str());
+        return 0;
+    }
+    FILE *f = fopen(outfile, "w");
+    if(!f || fwrite(program.data(), 1, program.size(), f) != program.size()) {
+        printf("Could not write %s.\n", outfile);
+        if(f) {
+            fclose(f);
+        }
+        return 1;
+    }
+    fclose(f);
+    return 0;
+}
@@ -17,11 +17,14 @@
 
 #include <fonttoy.hpp>
 #include <constraints.hpp>
+#include <stats.hpp>
 #include <cmath>
 #include <cassert>
 #include <unordered_set>
 #include <algorithm>
+#include <random>
 #include <string>
+#include <typeinfo>
 
 Vector Point::operator-(const Point &other) const { return Vector(x_ - other.x_, y_ - other.y_); }
 
@@ -100,6 +103,85 @@ Vector Bezier::evaluate_left_normal(const double t) const {
     return dn.normalized();
 }
 
+void IndexedMaxHeap::resize(int size) {
+    values.assign(size, 0.0);
+    heap.resize(size);
+    position.resize(size);
+    for(int i = 0; i < size; ++i) {
+        heap[i] = i;
+        position[i] = i;
+    }
+}
+
+void IndexedMaxHeap::update(int index, double value) {
+    const double old_value = values[index];
+    values[index] = value;
+    if(value > old_value) {
+        sift_up(position[index]);
+    } else {
+        sift_down(position[index]);
+    }
+}
+
+double IndexedMaxHeap::max_excluding(const std::vector<int> &excluded) const {
+    // Children are never above their parent, so a node that is not
+    // excluded covers its whole subtree.
+    double result = 0.0;
+    std::vector<int> stack;
+    if(!heap.empty()) {
+        stack.push_back(0);
+    }
+    while(!stack.empty()) {
+        const int pos = stack.back();
+        stack.pop_back();
+        const int index = heap[pos];
+        if(!std::binary_search(excluded.begin(), excluded.end(), index)) {
+            result = std::max(values[index], result);
+            continue;
+        }
+        for(int child = 2 * pos + 1; child <= 2 * pos + 2; ++child) {
+            if(child < (int)heap.size()) {
+                stack.push_back(child);
+            }
+        }
+    }
+    return result;
+}
+
+void IndexedMaxHeap::swap_nodes(int pos_a, int pos_b) {
+    std::swap(heap[pos_a], heap[pos_b]);
+    position[heap[pos_a]] = pos_a;
+    position[heap[pos_b]] = pos_b;
+}
+
+void IndexedMaxHeap::sift_up(int pos) {
+    while(pos > 0) {
+        const int parent = (pos - 1) / 2;
+        if(!higher(pos, parent)) {
+            break;
+        }
+        swap_nodes(pos, parent);
+        pos = parent;
+    }
+}
+
+void IndexedMaxHeap::sift_down(int pos) {
+    const int size = heap.size();
+    while(true) {
+        int largest = pos;
+        for(int child = 2 * pos + 1; child <= 2 * pos + 2; ++child) {
+            if(child < size && higher(child, largest)) {
+                largest = child;
+            }
+        }
+        if(largest == pos) {
+            break;
+        }
+        swap_nodes(pos, largest);
+        pos = largest;
+    }
+}
+
 Stroke::Stroke(const int num_beziers) : num_beziers(num_beziers) {
     const int num_points = num_beziers * 3 + 1;
     points.reserve(num_points);
@@ -147,17 +229,59 @@ void Stroke::set_free_variables(const std::vector<double> &v) {
 double Stroke::calculate_value_for(const std::vector<double> &vars) {
     assert(is_frozen);
     set_free_variables(vars);
-    return calculate_2nd_der() + calculate_limit_errors(vars);
+    const double curvature = update_segment_values();
+    limit_error = calculate_limit_errors(vars);
+    return curvature + limit_error;
+}
+
+double Stroke::calculate_value_with(const std::vector<double> &vars,
+                                    int var_index,
+                                    double new_value) {
+    assert(is_frozen);
+    assert(!segment_valid.empty());
+    const auto &inc = incidence[var_index];
+    auto &owner = constraints[inc.constraint];
+    const int num_owned = owner->num_free_variables();
+    std::vector<double> owned(vars.begin() + inc.offset, vars.begin() + inc.offset + num_owned);
+    saved_points.clear();
+    for(const int p : inc.touched) {
+        saved_points.push_back(points[p]);
+    }
+
+    owned[var_index - inc.offset] = new_value;
+    owner->get_free_variables_from(owned, 0);
+    // Same two passes as set_free_variables, over the affected part only.
+    for(int pass = 0; pass < 2; ++pass) {
+        STAT_COUNT(update_model_calls);
+        for(const int ci : inc.rerun) {
+            constraints[ci]->update_model(points);
+        }
+    }
+    double result = segment_values.max_excluding(inc.segments);
+    for(const int seg : inc.segments) {
+        result = std::max(segment_2nd_der(seg), result);
+    }
+    cache_stats.hits += num_beziers - inc.segments.size();
+    cache_stats.misses += inc.segments.size();
+
+    owned[var_index - inc.offset] = vars[var_index];
+    owner->get_free_variables_from(owned, 0);
+    for(size_t i = 0; i < inc.touched.size(); ++i) {
+        points[inc.touched[i]] = saved_points[i];
+    }
+    return result + (limit_error - limit_error_for(var_index, vars[var_index]) +
+                     limit_error_for(var_index, new_value));
 }
 
 void Stroke::update_model() {
+    STAT_COUNT(update_model_calls);
     // FIXME: add topological sorting here.
     for(auto &c : constraints) {
         c->update_model(points);
     }
 }
 
-void Stroke::freeze() {
+void Stroke::freeze(bool use_symmetry) {
     assert(!is_frozen);
     // Set up a free constraint for every point that has no
     // constraints yet. Otherwise the optimization routine
@@ -173,8 +297,352 @@ void Stroke::freeze() {
             assert(!error_message);
         }
     }
+    if(use_symmetry) {
+        auto r = find_symmetry();
+        if(r && keep_first_half(*r)) {
+            symmetry = std::make_unique<Reflection>(std::move(*r));
+        }
+    }
 
     is_frozen = true;
+    build_samples();
+    analyze_incidence();
+}
+
+static bool same_limit(const std::optional<double> &a, const std::optional<double> &b) {
+    if(!a || !b) {
+        return !a && !b;
+    }
+    // Angles only need to match modulo a full turn.
+    const double turns = (*a - *b) / (2.0 * M_PI);
+    return fabs(*a - *b) < 1e-9 || fabs(turns - round(turns)) < 1e-9;
+}
+
+// True if the constraints are of the same type, determine the same points
+// and have the same limits, and put the points at the same places when
+// given the same variables. The latter is checked on random points.
+static bool same_effect(Constraint &a, Constraint &b, int num_points) {
+    if(typeid(a) != typeid(b) || a.num_free_variables() != b.num_free_variables()) {
+        return false;
+    }
+    const auto da = a.determines_points();
+    const auto db = b.determines_points();
+    if(da.size() != db.size()) {
+        return false;
+    }
+    for(size_t i = 0; i < da.size(); ++i) {
+        if(da[i].index != db[i].index || da[i].w.x != db[i].w.x || da[i].w.y != db[i].w.y) {
+            return false;
+        }
+    }
+    const auto la = a.get_limits();
+    const auto lb = b.get_limits();
+    if(la.size() != lb.size()) {
+        return false;
+    }
+    for(size_t i = 0; i < la.size(); ++i) {
+        if(!same_limit(la[i].min_value, lb[i].min_value) ||
+           !same_limit(la[i].max_value, lb[i].max_value)) {
+            return false;
+        }
+    }
+
+    std::vector<double> saved_a, saved_b;
+    a.append_free_variables_to(saved_a);
+    b.append_free_variables_to(saved_b);
+    std::mt19937 gen(num_points);
+    std::uniform_real_distribution<double> value(0.2, 1.2);
+    std::uniform_real_distribution<double> coordinate(-1.0, 2.0);
+    bool same = true;
+    for(int trial = 0; same && trial < 2; ++trial) {
+        std::vector<double> vars(saved_a.size());
+        for(auto &v : vars) {
+            v = value(gen);
+        }
+        a.get_free_variables_from(vars, 0);
+        b.get_free_variables_from(vars, 0);
+        std::vector<Point> pa;
+        for(int i = 0; i < num_points; ++i) {
+            pa.emplace_back(coordinate(gen), coordinate(gen));
+        }
+        auto pb = pa;
+        a.update_model(pa);
+        b.update_model(pb);
+        for(int i = 0; same && i < num_points; ++i) {
+            same = fabs(pa[i].x() - pb[i].x()) < 1e-9 && fabs(pa[i].y() - pb[i].y()) < 1e-9;
+        }
+    }
+    a.get_free_variables_from(saved_a, 0);
+    b.get_free_variables_from(saved_b, 0);
+    return same;
+}
+
+// A stroke is symmetric if reversing it and reflecting it across an axis
+// gives the same set of constraints. The axis is the perpendicular
+// bisector of the first pair of fixed points that swap places.
+std::optional<Reflection> Stroke::find_symmetry() {
+    const int n = points.size();
+    Reflection r;
+    for(int i = 0; i < n; ++i) {
+        r.point_map.push_back(n - 1 - i);
+    }
+    std::vector<const FixedConstraint *> fixed(n, nullptr);
+    for(const auto &c : constraints) {
+        if(auto *f = dynamic_cast<const FixedConstraint *>(c.get())) {
+            fixed[f->get_point_index()] = f;
+        }
+    }
+    bool have_axis = false;
+    for(int i = 0; i < n / 2 && !have_axis; ++i) {
+        if(!fixed[i] || !fixed[n - 1 - i]) {
+            continue;
+        }
+        const Point &p = fixed[i]->get_point();
+        const Point &q = fixed[n - 1 - i]->get_point();
+        const Vector between = q - p;
+        if(between.length() < 1e-9) {
+            continue;
+        }
+        r.axis_point = p + between * 0.5;
+        r.axis_angle = between.angle() + M_PI / 2.0;
+        have_axis = true;
+    }
+    if(!have_axis) {
+        return std::optional<Reflection>();
+    }
+    // The middle point of an even number of beziers maps to itself. Its
+    // constraints are kept as they are, so only a fixed point on the axis
+    // keeps the halves joined.
+    if(n % 2 == 1) {
+        const int middle = n / 2;
+        if(!fixed[middle] || (r.apply(fixed[middle]->get_point()) - fixed[middle]->get_point())
+                                     .length() > 1e-9) {
+            return std::optional<Reflection>();
+        }
+    }
+
+    std::vector<std::vector<Constraint *>> by_point(n);
+    for(const auto &c : constraints) {
+        for(const auto &d : c->determines_points()) {
+            by_point[d.index].push_back(c.get());
+        }
+    }
+    for(const auto &c : constraints) {
+        auto image = c->reflected(r);
+        const auto determined = image->determines_points();
+        if(determined.empty()) {
+            return std::optional<Reflection>();
+        }
+        const auto &candidates = by_point[determined.front().index];
+        if(std::none_of(candidates.begin(), candidates.end(), [&](Constraint *other) {
+               return same_effect(*image, *other, n);
+           })) {
+            return std::optional<Reflection>();
+        }
+    }
+    return r;
+}
+
+// Replaces the constraints of the second half with reflections of the
+// first half. Fails if a constraint determines points in both halves.
+bool Stroke::keep_first_half(const Reflection &r) {
+    std::vector<bool> second_half;
+    for(const auto &c : constraints) {
+        int first = 0, second = 0;
+        for(const auto &d : c->determines_points()) {
+            if(d.index > r.map(d.index)) {
+                ++second;
+            } else {
+                ++first;
+            }
+        }
+        if(first > 0 && second > 0) {
+            return false;
+        }
+        second_half.push_back(second > 0);
+    }
+    std::vector<std::unique_ptr<Constraint>> kept;
+    for(size_t i = 0; i < constraints.size(); ++i) {
+        if(!second_half[i]) {
+            kept.push_back(std::move(constraints[i]));
+        }
+    }
+    for(int i = 0; i < (int)points.size(); ++i) {
+        if(i > r.map(i)) {
+            kept.push_back(
+                std::make_unique<ReflectConstraint>(i, r.map(i), r.axis_point, r.axis_angle));
+        }
+    }
+    constraints = std::move(kept);
+    limits.clear();
+    for(const auto &c : constraints) {
+        for(auto &&l : c->get_limits()) {
+            limits.emplace_back(l);
+        }
+    }
+    update_model();
+    update_model();
+    return true;
+}
+
+// Finds out which points every free variable moves by nudging it and
+// comparing the model. This is done at the current values and at a
+// shifted copy, so that a degenerate starting state (such as a handle of
+// zero length) does not hide a dependency.
+void Stroke::analyze_incidence() {
+    const auto vars = get_free_variables();
+    std::vector<std::vector<int>> writers(points.size());
+    incidence.clear();
+    int offset = 0;
+    for(int ci = 0; ci < (int)constraints.size(); ++ci) {
+        for(const auto &d : constraints[ci]->determines_points()) {
+            writers[d.index].push_back(ci);
+        }
+        const int n = constraints[ci]->num_free_variables();
+        for(int j = 0; j < n; ++j) {
+            VariableIncidence inc;
+            inc.constraint = ci;
+            inc.offset = offset;
+            incidence.push_back(std::move(inc));
+        }
+        offset += n;
+    }
+    assert(incidence.size() == vars.size());
+
+    std::vector<std::vector<bool>> moves(vars.size(), std::vector<bool>(points.size(), false));
+    auto shifted = vars;
+    for(size_t v = 0; v < shifted.size(); ++v) {
+        shifted[v] += 0.1 * (1 + v % 3);
+    }
+    for(const auto &probe : {vars, shifted}) {
+        set_free_variables(probe);
+        const auto base = points;
+        auto moved = probe;
+        for(size_t v = 0; v < vars.size(); ++v) {
+            moved[v] = probe[v] + 0.001 * std::max(1.0, fabs(probe[v]));
+            set_free_variables(moved);
+            moved[v] = probe[v];
+            for(size_t p = 0; p < points.size(); ++p) {
+                if(points[p].x() != base[p].x() || points[p].y() != base[p].y()) {
+                    moves[v][p] = true;
+                }
+            }
+        }
+    }
+    set_free_variables(vars);
+
+    for(size_t v = 0; v < vars.size(); ++v) {
+        auto &inc = incidence[v];
+        std::vector<bool> rerun(constraints.size(), false);
+        rerun[inc.constraint] = true;
+        for(int p = 0; p < (int)points.size(); ++p) {
+            if(!moves[v][p]) {
+                continue;
+            }
+            inc.points.push_back(p);
+            if(p % 3 == 0 && p > 0) {
+                inc.segments.push_back(p / 3 - 1);
+            }
+            if(p / 3 < num_beziers) {
+                inc.segments.push_back(p / 3);
+            }
+            for(const int ci : writers[p]) {
+                rerun[ci] = true;
+            }
+        }
+        std::sort(inc.segments.begin(), inc.segments.end());
+        inc.segments.erase(std::unique(inc.segments.begin(), inc.segments.end()),
+                           inc.segments.end());
+        std::vector<bool> touched(points.size(), false);
+        for(int ci = 0; ci < (int)constraints.size(); ++ci) {
+            if(!rerun[ci]) {
+                continue;
+            }
+            inc.rerun.push_back(ci);
+            for(const auto &d : constraints[ci]->determines_points()) {
+                touched[d.index] = true;
+            }
+        }
+        for(int p = 0; p < (int)points.size(); ++p) {
+            if(touched[p]) {
+                inc.touched.push_back(p);
+            }
+        }
+    }
+}
+
+// The sampling positions of the curvature objective, grouped by segment.
+// The normal is evaluated at the stroke parameter rather than the segment
+// parameter, which is kept as is so that results do not change.
+void Stroke::build_samples() {
+    segment_samples.assign(num_beziers, {});
+    double i = 0.0;
+    const double delta = 0.01;
+    const double cutoff = num_beziers;
+    while(i <= cutoff) {
+        const int bezier_ind = int(i);
+        assert(bezier_ind < num_beziers);
+        segment_samples[bezier_ind].emplace_back(fmod(i, 1.0), i);
+        i += delta;
+    }
+}
+
+void Stroke::set_sample_stride(int stride) {
+    assert(stride > 0);
+    if(stride != sample_stride) {
+        sample_stride = stride;
+        segment_valid.assign(segment_valid.size(), false);
+    }
+}
+
+void Stroke::fit_to(const std::vector<Point> &target) {
+    assert(target.size() == points.size());
+    for(auto &c : constraints) {
+        c->fit_to(target);
+    }
+    update_model();
+    update_model();
+}
+
+std::vector<int> Stroke::attached_strokes() const {
+    std::vector<int> result;
+    for(const auto &c : constraints) {
+        auto *a = dynamic_cast<const AttachConstraint *>(c.get());
+        if(a && std::find(result.begin(), result.end(), a->get_other_stroke()) == result.end()) {
+            result.push_back(a->get_other_stroke());
+        }
+    }
+    return result;
+}
+
+std::string Stroke::structure_key() const {
+    std::string key = std::to_string(num_beziers);
+    for(const auto &c : constraints) {
+        key += ';';
+        key += typeid(*c).name();
+        for(const auto &d : c->determines_points()) {
+            key += ',';
+            key += std::to_string(d.index);
+        }
+    }
+    return key;
+}
+
+void Stroke::append_parameters_to(std::vector<double> &parameters) const {
+    for(const auto &c : constraints) {
+        c->append_parameters_to(parameters);
+    }
+}
+
+void Stroke::attach_to(int stroke_index, const Stroke &other) {
+    for(auto &c : constraints) {
+        auto *a = dynamic_cast<AttachConstraint *>(c.get());
+        if(a && a->get_other_stroke() == stroke_index) {
+            a->set_target(other.points[a->get_other_point_index()]);
+        }
+    }
+    update_model();
+    update_model();
 }
 
 Point Stroke::evaluate(const double t) const {
@@ -188,45 +656,105 @@ Point Stroke::evaluate(const double t) const {
     return build_bezier(bezier_index).evaluate(bezier_t);
 }
 
-double Stroke::calculate_2nd_der() const {
-    auto beziers = build_beziers();
-    double i = 0.0;
-    double result = 0.0;
-    const double delta = 0.01;
-    const double cutoff = beziers.size();
-    while(i <= cutoff) {
-        const int bezier_ind = int(i);
-        const double bezier_i = fmod(i, 1.0);
-        const auto &cur_b = beziers[bezier_ind];
+double Stroke::segment_2nd_der(int segment) const {
+    const auto cur_b = build_bezier(segment + 1);
+    const auto &samples = segment_samples[segment];
+    auto sample_value = [&](size_t j) {
+        const auto &[bezier_i, i] = samples[j];
         const Vector h = cur_b.evaluate_d2(bezier_i);
         const Vector left_n = cur_b.evaluate_left_normal(i);
         double left_n_length = left_n.length(); // Should be one, but zero in the degenerate case.
-        if(left_n_length != 0) {
-            assert(fabs(left_n_length - 1.0) < 0.0001);
-            double projected = h.dot(left_n) / left_n.length();
-            result = std::max(fabs(projected), result);
+        if(left_n_length == 0) {
+            return 0.0;
+        }
+        assert(fabs(left_n_length - 1.0) < 0.0001);
+        return fabs(h.dot(left_n) / left_n.length());
+    };
+    double result = 0.0;
+    size_t peak = 0;
+    int num_samples = 0;
+    for(size_t j = 0; j < samples.size(); j += sample_stride, ++num_samples) {
+        const double value = sample_value(j);
+        if(value > result) {
+            result = value;
+            peak = j;
         }
-        i += delta;
     }
+    // Sparse samples would let the optimizer hide curvature between them,
+    // so the largest one is refined from its neighbours.
+    if(sample_stride > 1) {
+        const size_t from = peak > (size_t)sample_stride ? peak - sample_stride + 1 : 0;
+        const size_t to = std::min(peak + sample_stride, samples.size());
+        for(size_t j = from; j < to; ++j, ++num_samples) {
+            if((j % sample_stride) != 0) {
+                result = std::max(sample_value(j), result);
+            }
+        }
+    }
+    STAT_COUNT_N(bezier_samples, num_samples);
     return result;
 }
 
-double Stroke::calculate_limit_errors(const std::vector<double> &vars) const {
-    assert(limits.size() == vars.size());
-    double error = 0.0;
+bool Stroke::segment_unchanged(int segment) const {
+    if(!segment_valid[segment]) {
+        return false;
+    }
+    const double *key = &segment_keys[8 * segment];
+    for(int i = 0; i < 4; ++i) {
+        const auto &p = points[3 * segment + i];
+        if(key[2 * i] != p.x() || key[2 * i + 1] != p.y()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Re-samples only the segments whose control points have changed since
+// they were last sampled.
+double Stroke::update_segment_values() {
+    if(segment_valid.empty()) {
+        segment_values.resize(num_beziers);
+        segment_keys.resize(8 * num_beziers);
+        segment_valid.resize(num_beziers, false);
+    }
+    for(int i = 0; i < num_beziers; ++i) {
+        if(segment_unchanged(i)) {
+            ++cache_stats.hits;
+            continue;
+        }
+        ++cache_stats.misses;
+        double *key = &segment_keys[8 * i];
+        for(int j = 0; j < 4; ++j) {
+            key[2 * j] = points[3 * i + j].x();
+            key[2 * j + 1] = points[3 * i + j].y();
+        }
+        segment_valid[i] = true;
+        segment_values.update(i, segment_2nd_der(i));
+    }
+    return segment_values.max();
+}
+
+double Stroke::limit_error_for(int var_index, double value) const {
     auto err_func = [](const double a, const double b) {
         const double delta = fabs(a - b);
         return 10000.0 * delta * delta;
     };
+    const auto &l = limits[var_index];
+    double error = 0.0;
+    if(l.min_value && value < *l.min_value) {
+        error += err_func(value, *l.min_value);
+    }
+    if(l.max_value && value > *l.max_value) {
+        error += err_func(value, *l.max_value);
+    }
+    return error;
+}
+
+double Stroke::calculate_limit_errors(const std::vector<double> &vars) const {
+    assert(limits.size() == vars.size());
+    double error = 0.0;
     for(size_t i = 0; i < limits.size(); i++) {
-        const auto &v = vars[i];
-        const auto &l = limits[i];
-        if(l.min_value && v < *l.min_value) {
-            error += err_func(v, *l.min_value);
-        }
-        if(l.max_value && v > *l.max_value) {
-            error += err_func(v, *l.max_value);
-        }
+        error += limit_error_for(i, vars[i]);
     }
     return error;
 }
@@ -247,3 +775,110 @@ Bezier Stroke::build_bezier(int i) const {
     assert(3 * i < (int)points.size());
     return Bezier(points[3 * i - 3], points[3 * i - 2], points[3 * i - 1], points[3 * i]);
 }
+
+static Bezier line_bezier(const Point &p1, const Point &p2) {
+    const Vector third = (p2 - p1) * (1.0 / 3.0);
+    return Bezier(p1, p1 + third, p2 - third, p2);
+}
+
+std::vector<Bezier> closed_outline(const std::vector<Bezier> &left_beziers,
+                                   const std::vector<Bezier> &right_beziers) {
+    assert(!left_beziers.empty());
+    assert(!right_beziers.empty());
+    std::vector<Bezier> outline;
+    outline.reserve(left_beziers.size() + right_beziers.size() + 2);
+    for(const auto &b : left_beziers) {
+        outline.push_back(b);
+    }
+    outline.push_back(line_bezier(left_beziers.back().p2(), right_beziers.back().p2()));
+    for(int i = right_beziers.size() - 1; i >= 0; --i) {
+        const auto &b = right_beziers[i];
+        outline.emplace_back(b.p2(), b.c2(), b.c1(), b.p1());
+    }
+    outline.push_back(line_bezier(right_beziers.front().p1(), left_beziers.front().p1()));
+    return outline;
+}
+
+std::vector<Bezier> Shape::build_outline() const {
+    return closed_outline(left.build_beziers(), right.build_beziers());
+}
+
+Point AffineTransform::apply(const Point &p) const {
+    return Point(a * p.x() + b * p.y() + dx, c * p.x() + d * p.y() + dy);
+}
+
+// A frozen stroke whose points are all fixed to the transformed points
+// of the original. It has no free variables.
+static Stroke transformed_stroke(const Stroke &original, const AffineTransform &t) {
+    const auto &points = original.get_points();
+    Stroke result(((int)points.size() - 1) / 3);
+    for(int i = 0; i < (int)points.size(); ++i) {
+        auto error_message =
+            result.add_constraint(std::make_unique<FixedConstraint>(i, t.apply(points[i])));
+        assert(!error_message);
+    }
+    result.freeze(false);
+    return result;
+}
+
+Shape Shape::transformed(const AffineTransform &t) const {
+    Shape result(skeleton.num_points() / 3);
+    result.skeleton = transformed_stroke(skeleton, t);
+    // The side left of the travel direction ends up on its right.
+    result.left = transformed_stroke(t.mirrors() ? right : left, t);
+    result.right = transformed_stroke(t.mirrors() ? left : right, t);
+    result.pen = pen;
+    result.is_component = true;
+    return result;
+}
+
+std::vector<std::vector<int>> Glyph::components() const {
+    std::vector<int> parent(strokes.size());
+    for(size_t i = 0; i < parent.size(); ++i) {
+        parent[i] = i;
+    }
+    auto find = [&parent](int i) {
+        while(parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+    for(size_t i = 0; i < strokes.size(); ++i) {
+        for(const int other : strokes[i].skeleton.attached_strokes()) {
+            assert(other >= 0 && other < (int)i);
+            parent[find(i)] = find(other);
+        }
+    }
+    // Strokes only attach to earlier ones, so index order is a valid
+    // solving order within each group.
+    std::vector<std::vector<int>> result;
+    std::vector<int> group_of(strokes.size(), -1);
+    for(size_t i = 0; i < strokes.size(); ++i) {
+        const int root = find(i);
+        if(group_of[root] < 0) {
+            group_of[root] = result.size();
+            result.emplace_back();
+        }
+        result[group_of[root]].push_back(i);
+    }
+    return result;
+}
+
+std::vector<Bezier> Glyph::build_outline() const {
+    std::vector<Bezier> outline;
+    for(const auto &s : strokes) {
+        const auto contour = s.build_outline();
+        outline.insert(outline.end(), contour.begin(), contour.end());
+    }
+    return outline;
+}
+
+std::vector<std::vector<Bezier>> Glyph::build_contours() const {
+    std::vector<std::vector<Bezier>> contours;
+    contours.reserve(strokes.size());
+    for(const auto &s : strokes) {
+        contours.push_back(s.build_outline());
+    }
+    return contours;
+}
@@ -19,10 +19,50 @@
 
 #include <maths.hpp>
 #include <constraints.hpp>
+#include <pen.hpp>
 
 #include <vector>
 #include <memory>
 #include <optional>
+#include <string>
+
+// Max-heap over the values 0..n-1 that allows changing any of them.
+class IndexedMaxHeap final {
+public:
+    void resize(int size);
+    void update(int index, double value);
+    double value(int index) const { return values[index]; }
+    // Zero when empty, the values are curvature maxima.
+    double max() const { return heap.empty() ? 0.0 : values[heap.front()]; }
+    // Largest value whose index is not in the sorted exclusion list. Only
+    // looks at the nodes above and next to the excluded ones.
+    double max_excluding(const std::vector<int> &excluded) const;
+
+private:
+    bool higher(int pos_a, int pos_b) const { return values[heap[pos_a]] > values[heap[pos_b]]; }
+    void swap_nodes(int pos_a, int pos_b);
+    void sift_up(int pos);
+    void sift_down(int pos);
+
+    std::vector<double> values;
+    std::vector<int> heap;     // Indexes in heap order.
+    std::vector<int> position; // Where each index is in the heap.
+};
+
+struct SegmentCacheStats {
+    long long hits = 0;
+    long long misses = 0;
+};
+
+// How one free variable of a frozen stroke reaches the objective.
+struct VariableIncidence {
+    int constraint = 0; // Owner of the variable.
+    int offset = 0;     // Position of the owner's first variable.
+    std::vector<int> points;   // Points that move with the variable.
+    std::vector<int> segments; // Beziers containing those points.
+    std::vector<int> rerun;    // Constraints that must be updated.
+    std::vector<int> touched;  // Points written by those constraints.
+};
 
 class Stroke final {
 public:
@@ -33,17 +73,53 @@ public:
     std::optional<std::string> add_constraint(std::unique_ptr<Constraint> c);
 
     double calculate_value_for(const std::vector<double> &vars);
+    // Objective after changing one variable from the values given to the
+    // last calculate_value_for call. Only the segments that variable
+    // touches are re-sampled.
+    double calculate_value_with(const std::vector<double> &vars, int var_index, double new_value);
+    const std::vector<VariableIncidence> &get_incidence() const { return incidence; }
+    const SegmentCacheStats &get_cache_stats() const { return cache_stats; }
+    // The curvature objective looks at every stride:th sample and the
+    // neighbours of the largest one only. The estimate is cheaper and
+    // never above the one of all samples, which stride one uses.
+    void set_sample_stride(int stride);
     std::vector<Bezier> build_beziers() const;
     Bezier build_bezier(int i) const;
 
-    void freeze();
+    // With use_symmetry, a stroke whose constraints stay the same when
+    // it is reversed and reflected across an axis keeps the constraints
+    // of its first half only. The second half is then reflected from it.
+    void freeze(bool use_symmetry = true);
+    // The reflection that maps the stroke onto itself, or null.
+    const Reflection *get_symmetry() const { return symmetry.get(); }
+    // Moves the free variables towards the given point positions.
+    void fit_to(const std::vector<Point> &target);
+
+    // Indexes of the strokes this one has attachment constraints to.
+    std::vector<int> attached_strokes() const;
+    // Moves the points attached to the given stroke to their places.
+    void attach_to(int stroke_index, const Stroke &other);
 
+    int num_points() const { return (int)points.size(); }
     const std::vector<Point> &get_points() const { return points; }
+    // Describes the constraint types and the points they determine but
+    // not their numeric arguments. Strokes with equal keys have the same
+    // free variables.
+    std::string structure_key() const;
+    // The values of the constraints that are not free variables.
+    void append_parameters_to(std::vector<double> &parameters) const;
     Point evaluate(const double t) const;
 
 private:
     void update_model();
-    double calculate_2nd_der() const;
+    void analyze_incidence();
+    std::optional<Reflection> find_symmetry();
+    bool keep_first_half(const Reflection &r);
+    void build_samples();
+    double segment_2nd_der(int segment) const;
+    bool segment_unchanged(int segment) const;
+    double update_segment_values();
+    double limit_error_for(int var_index, double value) const;
     double calculate_limit_errors(const std::vector<double> &vars) const;
 
     int num_beziers;
@@ -52,12 +128,64 @@ private:
     std::vector<std::unique_ptr<Constraint>> constraints;
     std::vector<VariableLimits> limits;
     bool is_frozen = false; // No more constraints.
+    std::unique_ptr<Reflection> symmetry; // Keeps Stroke nothrow movable.
+
+    // Set up by freeze.
+    std::vector<VariableIncidence> incidence;
+    std::vector<std::vector<std::pair<double, double>>> segment_samples;
+    int sample_stride = 1;
+    // Curvature maxima of the last full evaluation, valid for segments
+    // whose control points still match the key.
+    IndexedMaxHeap segment_values;
+    std::vector<double> segment_keys; // Four points per segment.
+    std::vector<bool> segment_valid;
+    SegmentCacheStats cache_stats;
+    double limit_error = 0.0;
+    std::vector<Point> saved_points;
+};
+
+// x' = a x + b y + dx, y' = c x + d y + dy.
+struct AffineTransform {
+    double a = 1.0, b = 0.0, c = 0.0, d = 1.0;
+    double dx = 0.0, dy = 0.0;
+
+    Point apply(const Point &p) const;
+    // Mirroring transforms swap the left and right sides of a stroke.
+    bool mirrors() const { return a * d - b * c < 0; }
 };
 
 struct Shape {
     Stroke skeleton;
     Stroke left;
     Stroke right;
+    Pen pen;
+    // Taken already solved from another glyph, not optimized again.
+    bool is_component = false;
 
     Shape(int i) : skeleton(i), left(i), right(i) {}
+
+    std::vector<Bezier> build_outline() const;
+    // A component made of the solved strokes of this shape moved by t.
+    Shape transformed(const AffineTransform &t) const;
 };
+
+// A glyph is made of one or more strokes. Strokes can only attach to
+// strokes that were defined before them.
+struct Glyph {
+    std::vector<Shape> strokes;
+
+    // Groups of strokes connected by attachments. Each group is in
+    // dependency order and can be solved independently of the others.
+    std::vector<std::vector<int>> components() const;
+
+    // All strokes as one outline, for nonzero winding fills.
+    std::vector<Bezier> build_outline() const;
+    // One closed contour per stroke.
+    std::vector<std::vector<Bezier>> build_contours() const;
+};
+
+// Joins the left and right side into one closed outline: left side
+// forwards, a line over the end, right side backwards and a line back
+// to the start. Straight lines are expressed as degenerate beziers.
+std::vector<Bezier> closed_outline(const std::vector<Bezier> &left_beziers,
+                                   const std::vector<Bezier> &right_beziers);
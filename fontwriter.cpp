@@ -0,0 +1,524 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fontwriter.hpp>
+#include <stats.hpp>
+#include <cmath>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+const int max_quadratic_pieces = 32;
+
+// The part of b between parameters t0 and t1 as its own cubic.
+Bezier subsegment(const Bezier &b, double t0, double t1) {
+    const double third = (t1 - t0) / 3.0;
+    const Point q0 = b.evaluate(t0);
+    const Point q3 = b.evaluate(t1);
+    return Bezier(q0, q0 + b.evaluate_d1(t0) * third, q3 - b.evaluate_d1(t1) * third, q3);
+}
+
+QuadBezier approximate(const Bezier &b) {
+    // Average of the two control points implied by the end tangents.
+    const double cx = (3.0 * (b.c1().x() + b.c2().x()) - b.p1().x() - b.p2().x()) / 4.0;
+    const double cy = (3.0 * (b.c1().y() + b.c2().y()) - b.p1().y() - b.p2().y()) / 4.0;
+    return QuadBezier(b.p1(), Point(cx, cy), b.p2());
+}
+
+// Bound of the distance between the piece of the cubic and q at
+// matching parameter values. Raised to degree three, q has the same end
+// points as the piece, so their difference is 3u(1-u)((1-u)d1 + u d2)
+// for the differences d1 and d2 of the inner control points. Writing
+// that as 3u(1-u)(b + (1-2u)a) with a = (d1-d2)/2 and b = (d1+d2)/2 and
+// taking the maxima of the two polynomials in u gives the bound. The
+// control point of approximate makes b zero, so it is exact for them.
+double max_piece_deviation(const Bezier &piece, const QuadBezier &q) {
+    const Point q1 = q.p1() + (q.c() - q.p1()) * (2.0 / 3.0);
+    const Point q2 = q.p2() + (q.c() - q.p2()) * (2.0 / 3.0);
+    const Vector d1 = piece.c1() - q1;
+    const Vector d2 = piece.c2() - q2;
+    const Vector a = (d1 - d2) * 0.5;
+    const Vector b = d1 - a; // (d1 + d2) / 2
+    return a.length() / (2.0 * sqrt(3.0)) + 0.75 * b.length();
+}
+
+// Big endian serialization helpers.
+class Writer final {
+public:
+    void u8(uint8_t v) { data.push_back(v); }
+    void u16(uint16_t v) {
+        u8(v >> 8);
+        u8(v & 0xff);
+    }
+    void i16(int16_t v) { u16((uint16_t)v); }
+    void u32(uint32_t v) {
+        u16(v >> 16);
+        u16(v & 0xffff);
+    }
+    void tag(const char *t) {
+        for(int i = 0; i < 4; ++i) {
+            u8(t[i]);
+        }
+    }
+    void bytes(const std::vector<uint8_t> &v) { data.insert(data.end(), v.begin(), v.end()); }
+    void pad4() {
+        while(data.size() % 4 != 0) {
+            u8(0);
+        }
+    }
+    void put_u32(size_t offset, uint32_t v) {
+        data[offset] = v >> 24;
+        data[offset + 1] = (v >> 16) & 0xff;
+        data[offset + 2] = (v >> 8) & 0xff;
+        data[offset + 3] = v & 0xff;
+    }
+
+    std::vector<uint8_t> data;
+};
+
+uint32_t table_checksum(const std::vector<uint8_t> &d, size_t offset, size_t length) {
+    uint32_t sum = 0;
+    for(size_t i = 0; i < length; i += 4) {
+        uint32_t word = 0;
+        for(size_t j = 0; j < 4; ++j) {
+            word = (word << 8) | (i + j < length ? d[offset + i + j] : 0);
+        }
+        sum += word;
+    }
+    return sum;
+}
+
+struct GlyphOutline {
+    std::vector<int16_t> xs, ys;
+    std::vector<bool> on_curve;
+    std::vector<uint16_t> end_points;
+    int16_t xmin = 0, ymin = 0, xmax = 0, ymax = 0;
+};
+
+double signed_area(const std::vector<Bezier> &contour) {
+    double area = 0;
+    for(const auto &b : contour) {
+        const Point *pts[4] = {&b.p1(), &b.c1(), &b.c2(), &b.p2()};
+        for(int i = 0; i < 3; ++i) {
+            area += pts[i]->x() * pts[i + 1]->y() - pts[i + 1]->x() * pts[i]->y();
+        }
+    }
+    return area / 2.0;
+}
+
+GlyphOutline convert_glyph(const FontGlyph &g, const FontSettings &settings) {
+    GlyphOutline o;
+    const double scale = settings.units_per_em;
+    auto add_point = [&](const Point &p, bool on) {
+        o.xs.push_back((int16_t)lrint(p.x() * scale));
+        o.ys.push_back((int16_t)lrint(p.y() * scale));
+        o.on_curve.push_back(on);
+    };
+    for(const auto &contour : g.contours) {
+        if(contour.empty()) {
+            continue;
+        }
+        // TrueType fills clockwise outer contours.
+        std::vector<Bezier> oriented;
+        if(signed_area(contour) > 0) {
+            for(auto it = contour.rbegin(); it != contour.rend(); ++it) {
+                oriented.emplace_back(it->p2(), it->c2(), it->c1(), it->p1());
+            }
+        } else {
+            oriented = contour;
+        }
+        for(const auto &b : oriented) {
+            for(const auto &q : cubic_to_quadratic(b, settings.tolerance)) {
+                add_point(q.p1(), true);
+                add_point(q.c(), false);
+            }
+        }
+        o.end_points.push_back(o.xs.size() - 1);
+    }
+    if(!o.xs.empty()) {
+        o.xmin = *std::min_element(o.xs.begin(), o.xs.end());
+        o.xmax = *std::max_element(o.xs.begin(), o.xs.end());
+        o.ymin = *std::min_element(o.ys.begin(), o.ys.end());
+        o.ymax = *std::max_element(o.ys.begin(), o.ys.end());
+    }
+    return o;
+}
+
+std::vector<uint8_t> glyf_entry(const GlyphOutline &o) {
+    Writer w;
+    if(o.end_points.empty()) {
+        return w.data;
+    }
+    w.i16(o.end_points.size());
+    w.i16(o.xmin);
+    w.i16(o.ymin);
+    w.i16(o.xmax);
+    w.i16(o.ymax);
+    for(auto e : o.end_points) {
+        w.u16(e);
+    }
+    w.u16(0); // No instructions.
+    for(bool on : o.on_curve) {
+        w.u8(on ? 1 : 0); // Both coordinates as 16 bit deltas.
+    }
+    int16_t prev = 0;
+    for(auto x : o.xs) {
+        w.i16(x - prev);
+        prev = x;
+    }
+    prev = 0;
+    for(auto y : o.ys) {
+        w.i16(y - prev);
+        prev = y;
+    }
+    return w.data;
+}
+
+void name_record(Writer &records, Writer &strings, uint16_t id, const std::string &s) {
+    records.u16(3);      // Windows
+    records.u16(1);      // Unicode BMP
+    records.u16(0x409);  // en-US
+    records.u16(id);
+    records.u16(s.size() * 2);
+    records.u16(strings.data.size());
+    for(char c : s) {
+        strings.u16((uint8_t)c);
+    }
+}
+
+} // namespace
+
+Point QuadBezier::evaluate(const double t) const {
+    const double mt = 1.0 - t;
+    return Point(mt * mt * p1_.x() + 2.0 * mt * t * c_.x() + t * t * p2_.x(),
+                 mt * mt * p1_.y() + 2.0 * mt * t * c_.y() + t * t * p2_.y());
+}
+
+std::vector<QuadBezier> cubic_to_quadratic(const Bezier &b, const double tolerance) {
+    assert(tolerance > 0);
+    std::vector<QuadBezier> quads;
+    // The last piece count is taken whether it fits or not, so that the
+    // pieces always cover the whole cubic.
+    for(int n = 1; n <= max_quadratic_pieces; ++n) {
+        quads.clear();
+        bool fits = true;
+        for(int i = 0; i < n && (fits || n == max_quadratic_pieces); ++i) {
+            const auto piece = subsegment(b, double(i) / n, double(i + 1) / n);
+            quads.push_back(approximate(piece));
+            fits = fits && max_piece_deviation(piece, quads.back()) <= tolerance;
+        }
+        if(fits) {
+            break;
+        }
+    }
+    return quads;
+}
+
+double max_deviation(const Bezier &b, const std::vector<QuadBezier> &quads) {
+    double worst = 0;
+    const int n = quads.size();
+    for(int i = 0; i < n; ++i) {
+        const auto piece = subsegment(b, double(i) / n, double(i + 1) / n);
+        worst = std::max(worst, max_piece_deviation(piece, quads[i]));
+    }
+    return worst;
+}
+
+uint32_t codepoint_for_name(const std::string &name) {
+    if(name.size() == 1) {
+        return (uint8_t)name[0];
+    }
+    if(name.size() == 7 && name.compare(0, 3, "uni") == 0) {
+        char *end;
+        const unsigned long cp = strtoul(name.c_str() + 3, &end, 16);
+        if(*end == '\0') {
+            return cp;
+        }
+    }
+    return 0;
+}
+
+std::vector<uint8_t> build_truetype_font(const std::vector<FontGlyph> &glyphs,
+                                         const FontSettings &settings) {
+    const int num_glyphs = glyphs.size() + 1;
+    std::vector<GlyphOutline> outlines;
+    outlines.emplace_back(); // .notdef is empty.
+    for(const auto &g : glyphs) {
+        outlines.push_back(convert_glyph(g, settings));
+    }
+
+    // glyf and loca.
+    Writer glyf, loca;
+    int max_points = 0, max_contours = 0;
+    int16_t xmin = 0, ymin = 0, xmax = 0, ymax = 0;
+    bool have_bbox = false;
+    for(const auto &o : outlines) {
+        loca.u32(glyf.data.size());
+        glyf.bytes(glyf_entry(o));
+        glyf.pad4();
+        max_points = std::max<int>(max_points, o.xs.size());
+        max_contours = std::max<int>(max_contours, o.end_points.size());
+        if(!o.xs.empty()) {
+            xmin = have_bbox ? std::min(xmin, o.xmin) : o.xmin;
+            ymin = have_bbox ? std::min(ymin, o.ymin) : o.ymin;
+            xmax = have_bbox ? std::max(xmax, o.xmax) : o.xmax;
+            ymax = have_bbox ? std::max(ymax, o.ymax) : o.ymax;
+            have_bbox = true;
+        }
+    }
+    loca.u32(glyf.data.size());
+
+    // hmtx: side bearings are mirrored so the advance is xmin + xmax.
+    Writer hmtx;
+    int advance_max = 0, min_lsb = 0, min_rsb = 0, max_extent = 0;
+    long advance_sum = 0;
+    for(const auto &o : outlines) {
+        const int advance = o.xs.empty() ? settings.units_per_em / 2 : o.xmin + o.xmax;
+        hmtx.u16(advance);
+        hmtx.i16(o.xmin);
+        advance_max = std::max(advance_max, advance);
+        advance_sum += advance;
+        min_lsb = std::min<int>(min_lsb, o.xmin);
+        min_rsb = std::min<int>(min_rsb, advance - o.xmax);
+        max_extent = std::max<int>(max_extent, o.xmax);
+    }
+    const int ascender = settings.units_per_em;
+    const int descender = -(int)lrint(0.22 * settings.units_per_em);
+
+    Writer head;
+    head.u32(0x00010000);
+    head.u32(0x00010000);
+    head.u32(0); // checkSumAdjustment, patched at the end.
+    head.u32(0x5F0F3CF5);
+    head.u16(0x0003); // Baseline at y=0, lsb at x=0.
+    head.u16(settings.units_per_em);
+    head.u32(0); // created
+    head.u32(0);
+    head.u32(0); // modified
+    head.u32(0);
+    head.i16(xmin);
+    head.i16(ymin);
+    head.i16(xmax);
+    head.i16(ymax);
+    head.u16(0); // macStyle
+    head.u16(8); // lowestRecPPEM
+    head.i16(2); // fontDirectionHint
+    head.i16(1); // Long loca offsets.
+    head.i16(0);
+
+    Writer hhea;
+    hhea.u32(0x00010000);
+    hhea.i16(ascender);
+    hhea.i16(descender);
+    hhea.i16(0);
+    hhea.u16(advance_max);
+    hhea.i16(min_lsb);
+    hhea.i16(min_rsb);
+    hhea.i16(max_extent);
+    hhea.i16(1); // caretSlopeRise
+    hhea.i16(0);
+    hhea.i16(0);
+    for(int i = 0; i < 5; ++i) {
+        hhea.i16(0); // Reserved and metricDataFormat.
+    }
+    hhea.u16(num_glyphs);
+
+    Writer maxp;
+    maxp.u32(0x00010000);
+    maxp.u16(num_glyphs);
+    maxp.u16(max_points);
+    maxp.u16(max_contours);
+    maxp.u16(0);
+    maxp.u16(0);
+    maxp.u16(2); // maxZones
+    for(int i = 0; i < 8; ++i) {
+        maxp.u16(0);
+    }
+
+    // cmap, format 4 with one segment per mapped glyph.
+    std::vector<std::pair<uint16_t, uint16_t>> mapping;
+    for(size_t i = 0; i < glyphs.size(); ++i) {
+        if(glyphs[i].codepoint > 0 && glyphs[i].codepoint < 0xFFFF) {
+            mapping.emplace_back(glyphs[i].codepoint, i + 1);
+        }
+    }
+    std::sort(mapping.begin(), mapping.end());
+    mapping.erase(std::unique(mapping.begin(),
+                              mapping.end(),
+                              [](const auto &a, const auto &b) { return a.first == b.first; }),
+                  mapping.end());
+    const int seg_count = mapping.size() + 1;
+    int entry_selector = 0;
+    while((2 << entry_selector) <= seg_count) {
+        ++entry_selector;
+    }
+    const int search_range = 2 << entry_selector;
+    Writer cmap;
+    cmap.u16(0);
+    cmap.u16(1);
+    cmap.u16(3);
+    cmap.u16(1);
+    cmap.u32(12);
+    cmap.u16(4);
+    cmap.u16(16 + 8 * seg_count);
+    cmap.u16(0);
+    cmap.u16(seg_count * 2);
+    cmap.u16(search_range);
+    cmap.u16(entry_selector);
+    cmap.u16(seg_count * 2 - search_range);
+    for(const auto &m : mapping) {
+        cmap.u16(m.first);
+    }
+    cmap.u16(0xFFFF);
+    cmap.u16(0);
+    for(const auto &m : mapping) {
+        cmap.u16(m.first);
+    }
+    cmap.u16(0xFFFF);
+    for(const auto &m : mapping) {
+        cmap.u16((uint16_t)(m.second - m.first));
+    }
+    cmap.u16(1);
+    for(int i = 0; i < seg_count; ++i) {
+        cmap.u16(0);
+    }
+
+    Writer name_records, name_strings;
+    const std::string full_name = settings.family_name + " Regular";
+    std::string ps_name = settings.family_name + "-Regular";
+    std::replace(ps_name.begin(), ps_name.end(), ' ', '-');
+    name_record(name_records, name_strings, 1, settings.family_name);
+    name_record(name_records, name_strings, 2, "Regular");
+    name_record(name_records, name_strings, 4, full_name);
+    name_record(name_records, name_strings, 6, ps_name);
+    Writer name;
+    name.u16(0);
+    name.u16(4);
+    name.u16(6 + name_records.data.size());
+    name.bytes(name_records.data);
+    name.bytes(name_strings.data);
+
+    Writer post;
+    post.u32(0x00030000);
+    for(int i = 0; i < 7; ++i) {
+        post.u32(0);
+    }
+
+    Writer os2;
+    os2.u16(4);
+    os2.i16(advance_sum / num_glyphs);
+    os2.u16(400); // Regular
+    os2.u16(5);   // Medium width
+    os2.u16(0);   // Installable
+    const int em = settings.units_per_em;
+    for(int v : {em * 65 / 100, em * 60 / 100, 0, em * 7 / 100}) {
+        os2.i16(v); // Subscript.
+    }
+    for(int v : {em * 65 / 100, em * 60 / 100, 0, em * 35 / 100}) {
+        os2.i16(v); // Superscript.
+    }
+    os2.i16(em * 5 / 100);
+    os2.i16(em * 30 / 100);
+    os2.i16(0);
+    for(int i = 0; i < 10; ++i) {
+        os2.u8(0); // PANOSE
+    }
+    for(int i = 0; i < 4; ++i) {
+        os2.u32(0);
+    }
+    os2.tag("NONE");
+    os2.u16(0x40); // REGULAR
+    os2.u16(mapping.empty() ? 0 : mapping.front().first);
+    os2.u16(mapping.empty() ? 0 : mapping.back().first);
+    os2.i16(ascender);
+    os2.i16(descender);
+    os2.i16(0);
+    os2.u16(std::max<int>(ascender, ymax));
+    os2.u16(std::max<int>(-descender, -ymin));
+    os2.u32(1); // Latin 1
+    os2.u32(0);
+    os2.i16(em * 60 / 100); // sxHeight, as in the SVG guides.
+    os2.i16(em * 90 / 100);
+    os2.u16(0);
+    os2.u16(' ');
+    os2.u16(1);
+
+    // Directory entries must be sorted by tag.
+    const std::vector<std::pair<const char *, const Writer *>> tables{
+        {"OS/2", &os2},
+        {"cmap", &cmap},
+        {"glyf", &glyf},
+        {"head", &head},
+        {"hhea", &hhea},
+        {"hmtx", &hmtx},
+        {"loca", &loca},
+        {"maxp", &maxp},
+        {"name", &name},
+        {"post", &post},
+    };
+    int table_selector = 0;
+    while((2 << table_selector) <= (int)tables.size()) {
+        ++table_selector;
+    }
+    Writer font;
+    font.u32(0x00010000);
+    font.u16(tables.size());
+    font.u16(16 << table_selector);
+    font.u16(table_selector);
+    font.u16(tables.size() * 16 - (16 << table_selector));
+    const size_t directory_start = font.data.size();
+    for(size_t i = 0; i < tables.size(); ++i) {
+        font.tag(tables[i].first);
+        font.u32(0);
+        font.u32(0);
+        font.u32(0);
+    }
+    size_t head_offset = 0;
+    for(size_t i = 0; i < tables.size(); ++i) {
+        const auto &table = tables[i].second->data;
+        const size_t offset = font.data.size();
+        const size_t record = directory_start + 16 * i;
+        font.put_u32(record + 4, table_checksum(table, 0, table.size()));
+        font.put_u32(record + 8, offset);
+        font.put_u32(record + 12, table.size());
+        if(tables[i].second == &head) {
+            head_offset = offset;
+        }
+        font.bytes(table);
+        font.pad4();
+    }
+    font.put_u32(head_offset + 8, 0xB1B0AFBA - table_checksum(font.data, 0, font.data.size()));
+    return font.data;
+}
+
+bool write_truetype_font(const char *fname,
+                         const std::vector<FontGlyph> &glyphs,
+                         const FontSettings &settings) {
+    const auto data = build_truetype_font(glyphs, settings);
+    FILE *f = fopen(fname, "wb");
+    if(!f) {
+        return false;
+    }
+    const bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    STAT_COUNT_N(bytes_written, ftell(f));
+    fclose(f);
+    return ok;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <maths.hpp>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class QuadBezier final {
+public:
+    QuadBezier(Point p1, Point c, Point p2) : p1_(p1), c_(c), p2_(p2) {}
+
+    Point evaluate(const double t) const;
+
+    const Point &p1() const { return p1_; }
+    const Point &c() const { return c_; }
+    const Point &p2() const { return p2_; }
+
+private:
+    Point p1_, c_, p2_;
+};
+
+// Splits the cubic into the smallest number of equal parameter pieces
+// whose quadratic approximations all stay within the tolerance, or into
+// the most pieces allowed if even those do not.
+std::vector<QuadBezier> cubic_to_quadratic(const Bezier &b, const double tolerance);
+
+// Largest distance between the cubic and the quadratic pieces at
+// matching parameter values, or a bound slightly above it. This bounds
+// the geometric deviation.
+double max_deviation(const Bezier &b, const std::vector<QuadBezier> &quads);
+
+struct FontGlyph {
+    std::string name;
+    uint32_t codepoint = 0; // Zero for glyphs that are not in the cmap.
+    std::vector<std::vector<Bezier>> contours; // Each one closed.
+};
+
+struct FontSettings {
+    std::string family_name = "Fonttoy";
+    int units_per_em = 1000;
+    double tolerance = 0.001; // In em units.
+};
+
+// Builds a TrueType (glyf outline) font containing a .notdef glyph
+// followed by the given glyphs.
+std::vector<uint8_t> build_truetype_font(const std::vector<FontGlyph> &glyphs,
+                                         const FontSettings &settings);
+
+bool write_truetype_font(const char *fname,
+                         const std::vector<FontGlyph> &glyphs,
+                         const FontSettings &settings);
+
+// Glyph names like "a" or "uni00E4" map to their code point.
+uint32_t codepoint_for_name(const std::string &name);
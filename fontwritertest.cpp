@@ -0,0 +1,128 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "fontwriter.hpp"
+#include <cstdio>
+#include <cmath>
+#include <random>
+
+// Distance from p to the closest point of the quadratic spline, found by
+// dense sampling. Independent of the parametric error estimate used by
+// the converter itself.
+double distance_to_spline(const Point &p, const std::vector<QuadBezier> &quads) {
+    double best = 1e100;
+    for(const auto &q : quads) {
+        for(int i = 0; i <= 2000; ++i) {
+            best = std::min(best, (q.evaluate(i / 2000.0) - p).length());
+        }
+    }
+    return best;
+}
+
+int test_conversion() {
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> coord(-0.2, 1.2);
+    int failures = 0;
+    for(const double tolerance : {0.01, 0.001, 0.0001}) {
+        double worst = 0;
+        for(int i = 0; i < 100; ++i) {
+            Bezier b(Point(coord(gen), coord(gen)),
+                     Point(coord(gen), coord(gen)),
+                     Point(coord(gen), coord(gen)),
+                     Point(coord(gen), coord(gen)));
+            const auto quads = cubic_to_quadratic(b, tolerance);
+            const double parametric = max_deviation(b, quads);
+            double geometric = 0;
+            for(int j = 0; j <= 200; ++j) {
+                geometric = std::max(geometric, distance_to_spline(b.evaluate(j / 200.0), quads));
+            }
+            worst = std::max(worst, geometric);
+            if(parametric > tolerance || geometric > tolerance) {
+                printf("Cubic %d: deviation %g (parametric %g) with tolerance %g, %d pieces.\n",
+                       i,
+                       geometric,
+                       parametric,
+                       tolerance,
+                       (int)quads.size());
+                ++failures;
+            }
+        }
+        printf("Tolerance %g: worst deviation %g.\n", tolerance, worst);
+    }
+    // Too tight to reach with any number of pieces, which must still
+    // cover the whole cubic.
+    const Bezier arch(Point(0, 0), Point(0, 1), Point(1, 1), Point(1, 0));
+    const auto quads = cubic_to_quadratic(arch, 1e-9);
+    if((quads.front().p1() - arch.p1()).length() > 1e-12 ||
+       (quads.back().p2() - arch.p2()).length() > 1e-12) {
+        printf("Pieces of a cubic with an unreachable tolerance do not cover it.\n");
+        ++failures;
+    }
+    return failures;
+}
+
+uint32_t read_u32(const std::vector<uint8_t> &d, size_t o) {
+    return (uint32_t(d[o]) << 24) | (uint32_t(d[o + 1]) << 16) | (uint32_t(d[o + 2]) << 8) |
+           d[o + 3];
+}
+
+int test_font() {
+    FontGlyph square{"uni25A1", 0, {}};
+    square.codepoint = codepoint_for_name(square.name);
+    std::vector<Bezier> contour;
+    const Point corners[4] = {Point(0.1, 0.1), Point(0.1, 0.6), Point(0.6, 0.6), Point(0.6, 0.1)};
+    for(int i = 0; i < 4; ++i) {
+        const Point &a = corners[i];
+        const Point &b = corners[(i + 1) % 4];
+        contour.emplace_back(a, a + (b - a) * (1.0 / 3.0), a + (b - a) * (2.0 / 3.0), b);
+    }
+    square.contours.push_back(contour);
+    FontGlyph curve{"s", codepoint_for_name("s"), {}};
+    curve.contours.push_back(
+        {Bezier(Point(0, 0), Point(0, 1), Point(1, 1), Point(1, 0)),
+         Bezier(Point(1, 0), Point(0.7, 0), Point(0.3, 0), Point(0, 0))});
+    const auto font = build_truetype_font({square, curve}, FontSettings());
+    if(square.codepoint != 0x25A1 || curve.codepoint != 's') {
+        printf("Glyph name to code point mapping failed.\n");
+        return 1;
+    }
+    if(font.size() % 4 != 0 || read_u32(font, 0) != 0x00010000) {
+        printf("Bad font header.\n");
+        return 1;
+    }
+    // The whole font must sum to the magic value once the head table's
+    // adjustment is in place.
+    uint32_t sum = 0;
+    for(size_t i = 0; i < font.size(); i += 4) {
+        sum += read_u32(font, i);
+    }
+    if(sum != 0xB1B0AFBA) {
+        printf("Bad font checksum %08x.\n", sum);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int, char **) {
+    int failures = test_conversion() + test_font();
+    if(failures) {
+        printf("%d failures.\n", failures);
+        return 1;
+    }
+    printf("All font writer tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,312 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <frontend.hpp>
+#include <trace.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+
+// One line of the program with its own lexer and parser. Line and
+// column numbers of its tokens and nodes are relative to the line.
+struct ProgramLine {
+    explicit ProgramLine(const std::string &line)
+        : text(line), signature(program_signature(line, nullptr)), lexer(line), parser(lexer) {}
+
+    std::string text;
+    std::string signature;
+    Lexer lexer;
+    Parser parser;
+    std::optional<std::string> parse_error;
+    std::vector<int> number_nodes; // In source order.
+    std::vector<std::string> reads; // Variables the statement uses.
+    std::string assigns; // Empty if the statement is not an assignment.
+    int call_node = -1; // The external function call the statement consists of.
+
+    // The results of the last execution.
+    bool cached = false;
+    std::vector<double> inputs; // Values of reads.
+    double value = 0; // Of assigns.
+    int num_calls = 0;
+    std::vector<double> call_args;
+};
+
+namespace {
+
+// Tokens and nodes of a line are numbered as if it were the first line.
+std::string relocate_error(const std::string &error, int line_number) {
+    const auto colon = error.find(':');
+    if(colon == std::string::npos || colon == 0) {
+        return error;
+    }
+    for(size_t i = 0; i < colon; ++i) {
+        if(!isdigit((unsigned char)error[i])) {
+            return error;
+        }
+    }
+    return std::to_string(line_number) + error.substr(colon);
+}
+
+void analyze(ProgramLine &line) {
+    const auto &nodes = line.parser.get_nodes();
+    const auto &statements = line.parser.get_statements();
+    std::vector<bool> is_name(nodes.size(), false);
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        const auto &n = nodes[i];
+        if(n.type == NodeType::number) {
+            line.number_nodes.push_back(i);
+        } else if(n.type == NodeType::fncall || n.type == NodeType::assignment) {
+            is_name[n.left.value()] = true;
+        }
+    }
+    std::sort(line.number_nodes.begin(), line.number_nodes.end(), [&nodes](int a, int b) {
+        return nodes[a].column_number < nodes[b].column_number;
+    });
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        if(nodes[i].type != NodeType::id || is_name[i]) {
+            continue;
+        }
+        const auto &name = std::get<std::string>(nodes[i].value);
+        if(std::find(line.reads.begin(), line.reads.end(), name) == line.reads.end()) {
+            line.reads.push_back(name);
+        }
+    }
+    if(statements.size() != 1) {
+        return;
+    }
+    int top = statements[0];
+    if(nodes[top].type == NodeType::assignment) {
+        line.assigns = std::get<std::string>(nodes[nodes[top].left.value()].value);
+        top = nodes[top].right.value();
+    }
+    if(nodes[top].type == NodeType::fncall &&
+       std::get<std::string>(nodes[nodes[top].left.value()].value) != "cos") {
+        line.call_node = top;
+    }
+}
+
+std::unique_ptr<ProgramLine> parse_line(const std::string &text) {
+    auto line = std::make_unique<ProgramLine>(text);
+    if(line->parser.parse()) {
+        analyze(*line);
+    } else {
+        line->parse_error = line->parser.get_error();
+    }
+    return line;
+}
+
+// Patches the numbers of line to those of text, which must have the same
+// signature.
+void patch_line(ProgramLine &line, const std::string &text) {
+    std::vector<double> numbers;
+    program_signature(text, &numbers);
+    assert(numbers.size() == line.number_nodes.size());
+    for(size_t i = 0; i < numbers.size(); ++i) {
+        line.parser.set_number(line.number_nodes[i], numbers[i]);
+    }
+    line.text = text;
+    line.cached = false;
+}
+
+std::vector<std::string> split_lines(const std::string &program) {
+    std::vector<std::string> lines;
+    size_t start = 0;
+    while(start < program.size()) {
+        auto end = program.find('\n', start);
+        if(end == std::string::npos) {
+            end = program.size();
+        }
+        lines.emplace_back(program, start, end - start);
+        start = end + 1;
+    }
+    return lines;
+}
+
+// Passes calls on while recording them.
+class CallRecorder final : public ExternalFuncall {
+public:
+    explicit CallRecorder(ExternalFuncall *fp) : fp(fp) {}
+
+    funcall_result funcall(const std::string &funname, const std::vector<double> &args) override {
+        ++num_calls;
+        last_args = args;
+        return fp->funcall(funname, args);
+    }
+
+    ExternalFuncall *fp;
+    int num_calls = 0;
+    std::vector<double> last_args;
+};
+
+} // namespace
+
+// Follows the token rules of the lexer: identifiers may contain digits,
+// numbers are [0-9]+(\.[0-9]*)?.
+std::string program_signature(const std::string &program, std::vector<double> *numbers) {
+    std::string signature;
+    signature.reserve(program.size());
+    const char *c = program.c_str();
+    while(*c) {
+        if(isalpha((unsigned char)*c) || *c == '_') {
+            while(isalnum((unsigned char)*c) || *c == '_') {
+                signature += *c++;
+            }
+        } else if(isdigit((unsigned char)*c)) {
+            const char *literal_end = c;
+            while(isdigit((unsigned char)*literal_end)) {
+                ++literal_end;
+            }
+            if(*literal_end == '.') {
+                ++literal_end;
+                while(isdigit((unsigned char)*literal_end)) {
+                    ++literal_end;
+                }
+            }
+            // Not strtod directly, it would also take exponents.
+            if(numbers) {
+                numbers->push_back(strtod(std::string(c, literal_end).c_str(), nullptr));
+            }
+            signature += '#';
+            c = literal_end;
+        } else if(*c == ' ' || *c == '\t' || *c == '\r') {
+            ++c;
+        } else {
+            signature += *c++;
+        }
+    }
+    return signature;
+}
+
+IncrementalProgram::IncrementalProgram() = default;
+
+IncrementalProgram::~IncrementalProgram() = default;
+
+std::optional<std::string> IncrementalProgram::update(const std::string &program) {
+    TraceSpan span("IncrementalProgram::update");
+    stats = FrontEndStats{};
+    const auto texts = split_lines(program);
+    const size_t common = std::min(texts.size(), lines.size());
+    size_t prefix = 0;
+    while(prefix < common && lines[prefix]->text == texts[prefix]) {
+        ++prefix;
+    }
+    size_t suffix = 0;
+    while(suffix < common - prefix &&
+          lines[lines.size() - 1 - suffix]->text == texts[texts.size() - 1 - suffix]) {
+        ++suffix;
+    }
+
+    // The changed lines are matched with the old ones in order. Those
+    // that only differ in numbers keep their parse.
+    const size_t old_end = lines.size() - suffix;
+    const size_t new_end = texts.size() - suffix;
+    std::vector<std::unique_ptr<ProgramLine>> changed;
+    for(size_t i = prefix; i < new_end; ++i) {
+        if(i < old_end && !lines[i]->parse_error &&
+           lines[i]->signature == program_signature(texts[i], nullptr)) {
+            patch_line(*lines[i], texts[i]);
+            changed.push_back(std::move(lines[i]));
+            ++stats.lines_patched;
+        } else {
+            changed.push_back(parse_line(texts[i]));
+            ++stats.lines_lexed;
+        }
+    }
+    lines.erase(lines.begin() + prefix, lines.begin() + old_end);
+    lines.insert(lines.begin() + prefix,
+                 std::make_move_iterator(changed.begin()),
+                 std::make_move_iterator(changed.end()));
+    stats.lines = lines.size();
+
+    for(size_t i = 0; i < lines.size(); ++i) {
+        if(lines[i]->parse_error) {
+            return relocate_error(*lines[i]->parse_error, i + 1);
+        }
+    }
+    return std::optional<std::string>{};
+}
+
+std::optional<std::string> IncrementalProgram::execute(ExternalFuncall *fp) {
+    TraceSpan span("IncrementalProgram::execute");
+    stats.statements_executed = 0;
+    stats.statements_reused = 0;
+    stats.calls_replayed = 0;
+    std::unordered_map<std::string, double> env;
+    env["pi"] = M_PI;
+    env["e"] = M_E;
+    std::vector<double> inputs;
+    for(size_t line_index = 0; line_index < lines.size(); ++line_index) {
+        auto &line = *lines[line_index];
+        const int line_number = line_index + 1;
+        assert(!line.parse_error);
+        inputs.clear();
+        bool inputs_defined = true;
+        for(const auto &name : line.reads) {
+            auto it = env.find(name);
+            if(it == env.end()) {
+                inputs_defined = false;
+                break;
+            }
+            inputs.push_back(it->second);
+        }
+
+        const bool can_replay = line.num_calls == 0 || (line.num_calls == 1 && line.call_node >= 0);
+        if(line.cached && inputs_defined && can_replay && inputs == line.inputs) {
+            if(line.num_calls == 1) {
+                const auto &call = line.parser.get_nodes()[line.call_node];
+                const auto &fname =
+                    std::get<std::string>(line.parser.get_nodes()[call.left.value()].value);
+                auto res = fp->funcall(fname, line.call_args);
+                if(std::holds_alternative<std::string>(res)) {
+                    line.cached = false;
+                    return "Interpreter fail: " + std::to_string(line_number) + ':' +
+                           std::to_string(call.column_number) + ' ' + fname + ": " +
+                           std::get<std::string>(res);
+                }
+                // Such as the index of a new stroke.
+                line.value = std::get<double>(res);
+                ++stats.calls_replayed;
+            }
+            if(!line.assigns.empty()) {
+                env[line.assigns] = line.value;
+            }
+            ++stats.statements_reused;
+            continue;
+        }
+
+        CallRecorder recorder(fp);
+        Interpreter interpreter(line.parser, &recorder);
+        for(size_t i = 0; i < inputs.size(); ++i) {
+            interpreter.define_variable(line.reads[i], inputs[i]);
+        }
+        ++stats.statements_executed;
+        line.cached = false;
+        if(!interpreter.execute_program()) {
+            return "Interpreter fail: " + relocate_error(interpreter.get_error(), line_number);
+        }
+        if(!line.assigns.empty()) {
+            line.value = interpreter.get_variable(line.assigns).value();
+            env[line.assigns] = line.value;
+        }
+        line.inputs = inputs;
+        line.num_calls = recorder.num_calls;
+        line.call_args = std::move(recorder.last_args);
+        line.cached = true;
+    }
+    return std::optional<std::string>{};
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <parser.hpp>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Incremental lexing, parsing and execution of a program that is edited
+// over time. Every statement is exactly one line, so the program is kept
+// as one parsed unit per line. An update re-lexes only the lines that
+// differ from the previous text; lines where only numbers changed are
+// not even re-lexed but have their number nodes patched.
+//
+// Execution walks the units in order with the variable values so far.
+// A unit whose inputs have the same values as the last time is not
+// evaluated again: an assignment reuses its value and a function call,
+// such as a constraint, is replayed to the new receiver with the
+// recorded arguments. Changes thus propagate only to the statements that
+// read a changed variable, directly or through other statements.
+
+struct FrontEndStats {
+    int lines = 0;
+    int lines_lexed = 0;   // Re-lexed and parsed.
+    int lines_patched = 0; // Only numbers changed.
+    int statements_executed = 0;
+    int statements_reused = 0;
+    int calls_replayed = 0; // Reused statements that call a function.
+};
+
+struct ProgramLine;
+
+class IncrementalProgram final {
+public:
+    IncrementalProgram();
+    ~IncrementalProgram();
+
+    // Takes a new version of the program text. Returns a parse error.
+    std::optional<std::string> update(const std::string &program);
+
+    // Runs the program, sending function calls to fp. Returns a runtime
+    // error. Call after a successful update.
+    std::optional<std::string> execute(ExternalFuncall *fp);
+
+    // Since the last update.
+    const FrontEndStats &get_stats() const { return stats; }
+
+private:
+    std::vector<std::unique_ptr<ProgramLine>> lines;
+    FrontEndStats stats;
+};
+
+// The program text with every number literal replaced by #, and without
+// spaces and tabs. Programs with equal signatures parse to the same tree
+// except for the values of the numbers, which are appended to numbers.
+std::string program_signature(const std::string &program, std::vector<double> *numbers);
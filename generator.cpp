@@ -0,0 +1,96 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <generator.hpp>
+#include <cassert>
+#include <cstdarg>
+#include <cstdio>
+#include <random>
+
+namespace {
+
+// Crossing going up, crest, crossing going down, trough.
+enum class WavePhase : int { rising, crest, falling, trough };
+
+WavePhase phase_of(int point) { return WavePhase(point % 4); }
+
+void append_line(std::string &program, const char *format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    program += buf;
+    program += '\n';
+}
+
+// The incoming handle of on-curve point j, as seen from that point.
+void append_incoming_handle(std::string &program, int j) {
+    switch(phase_of(j)) {
+    case WavePhase::rising:
+        append_line(
+            program, "AngleConstraint(%d, %d, 9.0 * pi / 8.0, 11.0 * pi / 8.0)", 3 * j - 1, 3 * j);
+        break;
+    case WavePhase::falling:
+        append_line(
+            program, "AngleConstraint(%d, %d, 5.0 * pi / 8.0, 7.0 * pi / 8.0)", 3 * j - 1, 3 * j);
+        break;
+    default:
+        append_line(program, "DirectionConstraint(%d, %d, pi)", 3 * j, 3 * j - 1);
+        break;
+    }
+}
+
+} // namespace
+
+std::string generate_fdef(const GeneratorSettings &settings) {
+    assert(settings.num_beziers > 0);
+    const int n = settings.num_beziers;
+    std::mt19937 rng(settings.seed);
+    std::string program;
+    append_line(program, "Stroke(%d)", n);
+    if(settings.pen_radius > 0) {
+        append_line(program, "PenCircle(%.4f)", settings.pen_radius);
+    }
+    for(int j = 0; j <= n; ++j) {
+        const double x = 0.1 + 0.8 * j / n;
+        // Uniform in [-1, 1] without the implementation defined distributions.
+        const double r = 2.0 * (rng() / double(rng.max())) - 1.0;
+        double y = 0.5 + settings.jitter * settings.amplitude * r;
+        if(phase_of(j) == WavePhase::crest) {
+            y += settings.amplitude;
+        } else if(phase_of(j) == WavePhase::trough) {
+            y -= settings.amplitude;
+        }
+        append_line(program, "FixedConstraint(%d, %.4f, %.4f)", 3 * j, x, y);
+    }
+    append_line(program, "AngleConstraint(1, 0, pi / 8.0, 3.0 * pi / 8.0)");
+    for(int j = 1; j < n; ++j) {
+        append_incoming_handle(program, j);
+        // Alternate between the two continuations at the extremes.
+        if(phase_of(j) == WavePhase::crest || phase_of(j) == WavePhase::trough) {
+            if((j / 2) % 2 == 0) {
+                append_line(program, "MirrorConstraint(%d, %d, %d)", 3 * j + 1, 3 * j - 1, 3 * j);
+                continue;
+            }
+        }
+        append_line(program, "SmoothConstraint(%d, %d, %d)", 3 * j + 1, 3 * j - 1, 3 * j);
+    }
+    append_incoming_handle(program, n);
+    return program;
+}
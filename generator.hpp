@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdint>
+#include <string>
+
+// Writes synthetic .fdef programs of any size for scaling measurements.
+// The stroke is a wave through the em square, one quarter period per
+// bezier. All on-curve points are fixed. Handles at the crests and
+// troughs are horizontal and continue with either a mirror or a smooth
+// constraint, handles at the crossings of the middle line have an
+// allowed angle range and a smooth continuation. The result only depends
+// on the settings, so the same seed always gives the same program.
+
+struct GeneratorSettings {
+    int num_beziers = 6;
+    double amplitude = 0.3;   // Of the wave, in em.
+    double jitter = 0.1;      // Random height variation relative to the amplitude.
+    double pen_radius = 0.02; // Zero for no pen.
+    uint32_t seed = 1;
+};
+
+std::string generate_fdef(const GeneratorSettings &settings);
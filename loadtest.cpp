@@ -0,0 +1,182 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <server.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+// Sends the given programs to a fonttoy server from several connections
+// at once and reports the throughput and latency distribution.
+
+namespace {
+
+std::string read_file(const char *fname) {
+    FILE *f = fopen(fname, "r");
+    if(!f) {
+        return std::string();
+    }
+    std::string result;
+    char buf[4096];
+    size_t num_read;
+    while((num_read = fread(buf, 1, sizeof(buf), f)) > 0) {
+        result.append(buf, num_read);
+    }
+    fclose(f);
+    return result;
+}
+
+struct Totals {
+    std::mutex mutex;
+    std::vector<double> latencies; // Seconds.
+    int errors = 0;
+    int partial = 0;
+};
+
+void run_connection(const char *socket_path,
+                    const std::vector<std::string> &requests,
+                    int num_requests,
+                    std::atomic<int> &next_request,
+                    Totals &totals) {
+    const int fd = connect_unix_socket(socket_path);
+    FILE *in = fd >= 0 ? fdopen(fd, "r") : nullptr;
+    FILE *out = fd >= 0 ? fdopen(dup(fd), "w") : nullptr;
+    std::vector<double> latencies;
+    int errors = 0;
+    int partial = 0;
+    for(int i = next_request++; i < num_requests; i = next_request++) {
+        if(!in || !out) {
+            ++errors;
+            continue;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        if(!write_message(out, requests[i % requests.size()])) {
+            ++errors;
+            continue;
+        }
+        const auto response = read_message(in);
+        latencies.push_back(
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        if(!response || response->compare(0, 6, "error\n") == 0) {
+            ++errors;
+        } else if(response->compare(0, 8, "partial\n") == 0) {
+            ++partial;
+        }
+    }
+    if(out) {
+        fclose(out);
+    }
+    if(in) {
+        fclose(in);
+    }
+    std::lock_guard<std::mutex> lock(totals.mutex);
+    totals.latencies.insert(totals.latencies.end(), latencies.begin(), latencies.end());
+    totals.errors += errors;
+    totals.partial += partial;
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+    if(sorted.empty()) {
+        return 0;
+    }
+    const size_t i = std::min(sorted.size() - 1, (size_t)(p / 100.0 * sorted.size()));
+    return sorted[i];
+}
+
+void print_usage(const char *progname) {
+    printf("%s --socket=path [options] <input files>\n\n", progname);
+    printf("  --requests=200              total number of requests\n");
+    printf("  --concurrency=4             simultaneous connections\n");
+    printf("  --options=\"cache=0 warm=0\"  request options, see server.hpp\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    const char *socket_path = nullptr;
+    int num_requests = 200;
+    int concurrency = 4;
+    // Every request is solved from scratch unless asked otherwise.
+    std::string options = "cache=0 warm=0";
+    std::vector<std::string> requests;
+    for(int i = 1; i < argc; ++i) {
+        if(strncmp(argv[i], "--socket=", 9) == 0) {
+            socket_path = argv[i] + 9;
+        } else if(strncmp(argv[i], "--requests=", 11) == 0) {
+            num_requests = atoi(argv[i] + 11);
+        } else if(strncmp(argv[i], "--concurrency=", 14) == 0) {
+            concurrency = atoi(argv[i] + 14);
+        } else if(strncmp(argv[i], "--options=", 10) == 0) {
+            options = argv[i] + 10;
+        } else if(argv[i][0] != '-') {
+            const auto program = read_file(argv[i]);
+            if(program.empty()) {
+                printf("Could not read %s.\n", argv[i]);
+                return 1;
+            }
+            requests.push_back(program);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if(!socket_path || requests.empty() || num_requests <= 0 || concurrency <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    for(auto &r : requests) {
+        r = options + "\n" + r;
+    }
+
+    Totals totals;
+    std::atomic<int> next_request(0);
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int i = 0; i < concurrency; ++i) {
+        threads.emplace_back(run_connection,
+                             socket_path,
+                             std::cref(requests),
+                             num_requests,
+                             std::ref(next_request),
+                             std::ref(totals));
+    }
+    for(auto &t : threads) {
+        t.join();
+    }
+    const double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    auto &l = totals.latencies;
+    std::sort(l.begin(), l.end());
+    printf("Options:     %s\n", options.c_str());
+    printf("Requests:    %d (%d errors, %d partial)\n", num_requests, totals.errors, totals.partial);
+    printf("Throughput:  %.1f requests/s\n", num_requests / elapsed);
+    printf("Latency p50: %.2f ms\n", percentile(l, 50) * 1000);
+    printf("Latency p90: %.2f ms\n", percentile(l, 90) * 1000);
+    printf("Latency p99: %.2f ms\n", percentile(l, 99) * 1000);
+    printf("Latency max: %.2f ms\n", l.empty() ? 0.0 : l.back() * 1000);
+    return totals.errors ? 1 : 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <list>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Least recently used cache. Not thread safe.
+template<typename V> class LruCache final {
+public:
+    explicit LruCache(size_t capacity) : capacity(capacity) {}
+
+    std::optional<V> get(const std::string &key) {
+        auto it = index.find(key);
+        if(it == index.end()) {
+            return std::optional<V>();
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+
+    void put(const std::string &key, V value) {
+        auto it = index.find(key);
+        if(it != index.end()) {
+            it->second->second = std::move(value);
+            entries.splice(entries.begin(), entries, it->second);
+            return;
+        }
+        entries.emplace_front(key, std::move(value));
+        index[key] = entries.begin();
+        if(entries.size() > capacity) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+private:
+    size_t capacity;
+    std::list<std::pair<std::string, V>> entries;
+    std::unordered_map<std::string, typename std::list<std::pair<std::string, V>>::iterator>
+        index;
+};
@@ -20,497 +20,760 @@
 #endif
 
 #include <cstdio>
-#include <fonttoy.hpp>
-#include <constraints.hpp>
-#include <svgexporter.hpp>
-#include <parser.hpp>
+#include <optimizer.hpp>
+#include <rasterizer.hpp>
+#include <sdf.hpp>
+#include <fontwriter.hpp>
+#include <stats.hpp>
+#include <trace.hpp>
+#include <server.hpp>
+#include <session.hpp>
+#include <phasecache.hpp>
+#include <designspace.hpp>
+#include <sweep.hpp>
+#include <sensitivity.hpp>
+#include <multistart.hpp>
+#include <algorithm>
+#include <filesystem>
+#include <memory>
 #include <vector>
-#include <lbfgs.h>
 #include <cassert>
-#include <cmath>
+#include <cstring>
+#include <cstdlib>
 #if defined(WASM)
 #include <emscripten.h>
 #endif
 
-static_assert(sizeof(lbfgsfloatval_t) == sizeof(double));
+#if defined(WASM)
 
-typedef double (*fptr)(const double *, const int);
+// Store all evaluated frames here for the UI.
 
-double maxd(const double d1, const double d2) { return d1 > d2 ? d1 : d2; }
+static std::vector<std::string> frames;
 
-enum class OptPhase : char { uninit, skeleton, left, right, finished };
+extern "C" {
 
-double distance_error(Shape *s, const std::vector<double> &x, OptPhase which) {
-    assert(which == OptPhase::left || which == OptPhase::right);
-    double total_error = 0;
-    auto skel_beziers = s->skeleton.build_beziers();
-    Stroke *side = which == OptPhase::left ? &s->left : &s->right;
-    side->set_free_variables(x);
-    auto side_beziers = side->build_beziers();
-    assert(skel_beziers.size() == side_beziers.size());
-    for(int bez_index = 0; bez_index < (int)skel_beziers.size(); ++bez_index) {
-        for(int i = 1; i < 4; ++i) {
-            double t = i / 4.0;
-            double target_distance = 0.05; // FIXME, calculate from pen shape.
-            auto skel_point = skel_beziers[bez_index].evaluate(t);
-            auto side_point = side_beziers[bez_index].evaluate(t);
-            auto offset = skel_point - side_point;
-            auto distance = offset.length();
-            auto diff = distance - target_distance;
-            total_error += diff * diff;
-        }
-    }
-    return total_error;
+int EMSCRIPTEN_KEEPALIVE num_frames() {
+    return (int) frames.size();
 }
 
-struct OptimizerState {
-    Shape *s;
-    OptPhase phase = OptPhase::uninit;
-    std::vector<std::string> frames;
-
-    double calculate_value_for(const std::vector<double> &x) const {
-        switch(phase) {
-        case OptPhase::skeleton:
-            return s->skeleton.calculate_value_for(x);
-        case OptPhase::right:
-        case OptPhase::left:
-            return distance_error(s, x, phase);
-        default:
-            assert(false);
-        }
-        return 0.0 / 0.0;
+void EMSCRIPTEN_KEEPALIVE get_frame(int num, char *buf) {
+    if(num < 0 || num > (int)frames.size()) {
+        return;
     }
-};
-
-std::vector<double> compute_absolute_step(double rel_step, const std::vector<double> &x) {
-    std::vector<double> h;
-    h.reserve(x.size());
-    for(size_t i = 0; i < x.size(); ++i) {
-        double sign_x = x[i] >= 0 ? 1.0 : -1.0;
-        h.push_back(rel_step * sign_x * maxd(1.0, fabs(x[i])));
-    }
-    return h;
-}
-
-std::vector<double> estimate_derivative(OptimizerState *args,
-                                        const std::vector<double> &x,
-                                        double f0,
-                                        const std::vector<double> &h) {
-    std::vector<double> g(x.size());
-    std::vector<double> x0 = x;
-    for(size_t i = 0; i < x.size(); i++) {
-        double old_v = x0[i];
-        x0[i] += h[i];
-        double dx = h[i];
-        double df = args->calculate_value_for(x0) - f0;
-        g[i] = df / dx;
-        x0[i] = old_v;
-    }
-    return g;
+    strcpy(buf, frames[num].c_str());
 }
 
-void put_beziers_in(Stroke &s, SvgExporter &svg, bool draw_controls) {
-    for(const auto b : s.build_beziers()) {
-        svg.draw_bezier(b.p1(), b.c1(), b.c2(), b.p2(), draw_controls);
+static int run_program(char *buf, OptimizerState &state) {
+    std::string program(buf);
+    auto s = calculate_sample_dynamically(state, program);
+    if(std::holds_alternative<std::string>(s)) {
+        strcpy(buf, std::get<std::string>(s).c_str());
+        return 1;
     }
+    state.frames.push_back(build_svg(std::get<Glyph>(s), state.phase));
+    strcpy(buf, state.frames.back().c_str());
+    frames = std::move(state.frames);
+    return state.partial ? 2 : 0;
 }
 
-void draw_shape(Shape &s, SvgExporter &svg) {
-    auto left_beziers = s.left.build_beziers();
-    auto right_beziers = s.right.build_beziers();
-    svg.draw_shape(left_beziers, right_beziers);
-}
-
-
-void put_indexes_in(Stroke &s, SvgExporter &svg) {
-    char buf[1024];
-    auto &points = s.get_points();
-    for(int i = 0; i < (int)points.size(); i += 3) {
-        const auto &p = points[i];
-        const double label_x = p.x() - 0.006;
-        const double label_y = p.y() + 0.02;
-        sprintf(buf, "%d", i);
-        svg.draw_text(label_x, label_y, 0.02, buf);
-    }
+int EMSCRIPTEN_KEEPALIVE wasm_entrypoint(char *buf) {
+    OptimizerState state;
+    state.num_threads = 1;
+    return run_program(buf, state);
 }
 
-void build_svg(Shape &s, SvgExporter &svg, OptPhase phase) {
-    if(phase == OptPhase::finished) {
-        draw_shape(s, svg);
-    }
-    put_beziers_in(s.skeleton, svg, true);
-    put_indexes_in(s.skeleton, svg);
-    if(phase == OptPhase::left || phase == OptPhase::right) {
-        put_beziers_in(s.left, svg, false);
-    }
-    if(phase == OptPhase::right) {
-        put_beziers_in(s.right, svg, false);
+// For live editing. Solves are warm started from the previous program,
+// which is patched instead of parsed again if only numbers changed.
+int EMSCRIPTEN_KEEPALIVE wasm_session_update(char *buf, int budget_ms) {
+    static Session session;
+    auto result = session.update(std::string(buf), budget_ms);
+    if(result.error) {
+        strcpy(buf, result.error->c_str());
+        return 1;
     }
+    strcpy(buf, build_svg(session.get_glyph(), OptPhase::finished).c_str());
+    frames.clear();
+    return result.partial ? 2 : 0;
 }
 
-std::string build_svg(Shape &s, OptPhase phase) {
-    SvgExporter svg;
-    build_svg(s, svg, phase);
-    return svg.to_string();
-}
-
-void write_svg(Shape &s, const char *fname, OptPhase phase) {
-    SvgExporter svg;
-    build_svg(s, svg, phase);
-    svg.write_svg(fname);
+// For previews: returns within about budget_ms milliseconds with the best
+// shape found so far. The return value is 2 if the shape is partial.
+int EMSCRIPTEN_KEEPALIVE wasm_preview(char *buf, int budget_ms) {
+    OptimizerState state;
+    state.num_threads = 1;
+    state.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(budget_ms);
+    return run_program(buf, state);
 }
-
-static lbfgsfloatval_t evaluate_model(void *instance,
-                                      const lbfgsfloatval_t *x,
-                                      lbfgsfloatval_t *g,
-                                      const int n,
-                                      const lbfgsfloatval_t step) {
-    auto args = reinterpret_cast<OptimizerState *>(instance);
-    (void)step;
-    const double rel_step = 0.000000001;
-    std::vector<double> curx(x, x + n);
-    double fx = args->calculate_value_for(curx);
-    args->frames.push_back(build_svg(*args->s, args->phase));
-    auto curh = compute_absolute_step(rel_step, curx);
-    auto g_est = estimate_derivative(args, curx, fx, curh);
-    for(int i = 0; i < n; i++) {
-        g[i] = g_est[i];
-    }
-    printf("Evaluation: %f\n", fx);
-    return fx;
 }
 
-int model_progress(void *instance,
-                   const lbfgsfloatval_t *,
-                   const lbfgsfloatval_t *,
-                   const lbfgsfloatval_t,
-                   const lbfgsfloatval_t,
-                   const lbfgsfloatval_t,
-                   const lbfgsfloatval_t,
-                   int,
-                   int k,
-                   int) {
-    printf("Iteration %d\n", k);
-    auto *args = reinterpret_cast<OptimizerState *>(instance);
-    args->frames.push_back(build_svg(*args->s, args->phase));
+int main(int, char **) {
+    printf("Fonttoy Wasm initialized.\n");
     return 0;
 }
 
-void optimize_skeleton(Shape *shape, OptimizerState &state) {
-    assert(state.phase == OptPhase::skeleton);
-    state.s = shape;
-    Stroke *s = &shape->skeleton;
-    double final_result = 1e8;
-    auto variables = s->get_free_variables();
-    assert(variables.size() == 7);
-    s->freeze();
-    variables = s->get_free_variables();
-    assert(variables.size() == 9);
-
-    s->calculate_value_for(variables);
-    state.frames.push_back(build_svg(*shape, state.phase));
+#else
 
-    lbfgs_parameter_t param;
-    lbfgs_parameter_init(&param);
-    int ret = lbfgs(variables.size(),
-                    &variables[0],
-                    &final_result,
-                    evaluate_model,
-                    model_progress,
-                    &state,
-                    &param);
-    printf("Skeleton exit value: %d\n", ret);
-    // insert final values back in the stroke here.
-    s->calculate_value_for(variables);
+std::string read_file(const char *fname) {
+    FILE *f = fopen(fname, "r");
+    assert(f);
+    const int bufsize = 1000000;
+    // Must be heap allocated so no std::array.
+    std::unique_ptr<char[]> buf(new(char[bufsize]));
+    auto num_read = fread(buf.get(), 1, bufsize, f);
+    fclose(f);
+    return std::string(buf.get(), buf.get() + num_read);
 }
 
-void optimize_side(Shape *shape, OptimizerState &state) {
-    Stroke *skel = &shape->skeleton;
-    double final_result = 1e8;
-    const double r = 0.05;
-    state.s = shape;
-    auto skel_b = skel->build_beziers();
-    auto side = state.phase == OptPhase::left ? &shape->left : &shape->right;
-    const auto &skel_points = skel->get_points();
-    const auto &side_points = side->get_points();
-    assert(skel_points.size() == side_points.size());
-
-    // Each side point is at a fixed location w.r.t. to the skeleton point.
-    for(int i = 0; i < (int)skel_points.size(); i += 3) {
-        int bezier_index, eval_point;
-        if(i == (int)skel_points.size() - 1) {
-            bezier_index = (int)skel_b.size() - 1;
-            eval_point = 1.0;
-        } else {
-            bezier_index = i / 3;
-            eval_point = 0.0;
-        }
-        int flipper = state.phase == OptPhase::left ? 1 : -1;
-        Point skel_point = skel_b[bezier_index].evaluate(eval_point);
-        Vector side_normal = skel_b[bezier_index].evaluate_left_normal(eval_point);
-        Point side_point = skel_point + flipper * r * side_normal;
-        auto rc = side->add_constraint(std::make_unique<FixedConstraint>(i, side_point));
-        assert(!rc);
+void print_frames(const std::vector<std::string> &frames) {
+    TraceSpan span("print_frames");
+    char buf[256];
+    for(size_t i=0; i<frames.size(); i++) {
+        sprintf(buf, "frame%03d.svg", (int)i);
+        FILE *f = fopen(buf, "w");
+        fwrite(frames[i].c_str(), 1, frames[i].size(), f);
+        STAT_COUNT_N(bytes_written, frames[i].size());
+        fclose(f);
     }
-
-    // Each control point _after_ a fixed point defines the direction.
-    // Each control point _before_ a fixed point defines smoothness.
-    // The very last point is special in each case.
-    for(int i = 0; i < (int)skel_b.size(); ++i) {
-        auto direction = skel_b[i].evaluate_d1(0.0);
-        auto theta = direction.angle();
-        auto rc =
-            side->add_constraint(std::make_unique<DirectionConstraint>(i * 3, i * 3 + 1, theta));
-        assert(!rc);
-    }
-    auto backwards_angle = skel_b.back().evaluate_d1(1.0).angle() + M_PI;
-    auto rc = side->add_constraint(std::make_unique<DirectionConstraint>(
-        skel_points.size() - 1, skel_points.size() - 2, backwards_angle));
-    assert(!rc);
-
-    for(int i = 1; i < (int)skel_b.size(); ++i) {
-        int middle_curve_point = 3 * i;
-        int this_control_index = 3 * i - 1;
-        int other_control_index = 3 * i + 1;
-        auto rc = side->add_constraint(std::make_unique<SmoothConstraint>(
-            this_control_index, other_control_index, middle_curve_point));
-        assert(!rc);
+}
+void write_raster(const Glyph &g, const char *fname, int size) {
+    TraceSpan span("write_raster");
+    Rasterizer r(size);
+    r.draw_outline(g.build_outline());
+    if(!write_pgm(fname, r.get_coverage(), size, size)) {
+        printf("Could not write %s.\n", fname);
     }
-
-    side->freeze();
-    auto variables = side->get_free_variables();
-
-    lbfgs_parameter_t param;
-    lbfgs_parameter_init(&param);
-    int ret = lbfgs(variables.size(),
-                    &variables[0],
-                    &final_result,
-                    evaluate_model,
-                    model_progress,
-                    &state,
-                    &param);
-    side->calculate_value_for(variables);
-    printf("Side exit value: %d\n", ret);
 }
 
-void optimize(OptimizerState &state, Shape *shape) {
-    assert(state.phase == OptPhase::uninit);
-    state.phase = OptPhase::skeleton;
-    optimize_skeleton(shape, state);
-    state.phase = OptPhase::left;
-    optimize_side(shape, state);
-    state.phase = OptPhase::right;
-    optimize_side(shape, state);
-    state.phase = OptPhase::finished;
+std::string glyph_name(const char *fname) {
+    std::string name(fname);
+    auto slash = name.find_last_of("/\\");
+    if(slash != std::string::npos) {
+        name = name.substr(slash + 1);
+    }
+    auto dot = name.rfind('.');
+    if(dot != std::string::npos && dot > 0) {
+        name = name.substr(0, dot);
+    }
+    return name;
 }
 
-class Bridge : public ExternalFuncall {
-public:
-    funcall_result funcall(const std::string &funname, const std::vector<double> &args) override {
-        if(funname == "Stroke") {
-            if(s) {
-                return "Second call to stroke.";
-            }
-            if(args.size() != 1) {
-                return "Wrong number of arguments.";
-            }
-            s.reset(new Shape(args[0]));
-            return 0.0;
-        } else if(funname == "FixedConstraint") {
-            if(!s) {
-                return "Stroke not set.";
-            }
-            if(args.size() != 3) {
-                return "Wrong number of arguments.";
-            }
-            auto r = s->skeleton.add_constraint(
-                std::make_unique<FixedConstraint>(args[0], Point(args[1], args[2])));
-            if(r) {
-                return *r;
-            }
-            return 0.0;
-        } else if(funname == "DirectionConstraint") {
-            if(!s) {
-                return "Stroke not set.";
-            }
-            if(args.size() != 3) {
-                return "Wrong number of arguments.";
-            }
-            auto r = s->skeleton.add_constraint(
-                std::make_unique<DirectionConstraint>(args[0], args[1], args[2]));
-            if(r) {
-                return *r;
-            }
-            return 0.0;
-        } else if(funname == "MirrorConstraint") {
-            if(!s) {
-                return "Stroke not set.";
-            }
-            if(args.size() != 3) {
-                return "Wrong number of arguments.";
-            }
-            auto r = s->skeleton.add_constraint(
-                std::make_unique<MirrorConstraint>(args[0], args[1], args[2]));
-            if(r) {
-                return *r;
-            }
-            return 0.0;
-        } else if(funname == "SmoothConstraint") {
-            if(!s) {
-                return "Stroke not set.";
-            }
-            if(args.size() != 3) {
-                return "Wrong number of arguments.";
-            }
-            auto r = s->skeleton.add_constraint(
-                std::make_unique<SmoothConstraint>(args[0], args[1], args[2]));
-            if(r) {
-                return *r;
-            }
-            return 0.0;
-        } else if(funname == "AngleConstraint") {
-            if(!s) {
-                return "Stroke not set.";
-            }
-            if(args.size() != 4) {
-                return "Wrong number of arguments.";
-            }
-            auto r = s->skeleton.add_constraint(
-                std::make_unique<AngleConstraint>(args[0], args[1], args[2], args[3]));
-            if(r) {
-                return *r;
-            }
-            return 0.0;
-        } else if(funname == "SameOffsetConstraint") {
-            if(!s) {
-                return "Stroke not set.";
-            }
-            if(args.size() != 4) {
-                return "Wrong number of arguments.";
-            }
-            auto r = s->skeleton.add_constraint(
-                std::make_unique<SameOffsetConstraint>(args[0], args[1], args[2], args[3]));
-            if(r) {
-                return *r;
-            }
-            return 0.0;
-        } else {
-            return "Unknown function.";
-        }
-        return 0;
+// To stdout if no file name is given.
+bool write_stats(const char *fname) {
+    const auto json = stats_json();
+    if(!fname) {
+        printf("%s", json.c_str());
+        return true;
     }
-
-    bool has_shape() { return (bool)s; }
-
-    Shape &get_shape() {
-        assert(s);
-        return *s.get();
+    FILE *f = fopen(fname, "w");
+    if(!f) {
+        return false;
     }
+    const bool ok = fwrite(json.data(), 1, json.size(), f) == json.size();
+    fclose(f);
+    return ok;
+}
 
-private:
-    std::unique_ptr<Shape> s;
+struct GlyphTelemetry {
+    std::string glyph;
+    std::vector<IterationRecord> records;
 };
 
-std::variant<Shape, std::string> calculate_sample_dynamically(OptimizerState &state, const std::string &program) {
-    Bridge b;
-    Lexer l(program);
-    Parser p(l);
-    Interpreter i(p, &b);
-
-    if(!p.parse()) {
-        std::string err("Parser fail: ");
-        err += p.get_error();
-        return err;
+// JSON if the file name ends in .json, CSV otherwise.
+bool write_telemetry(const char *fname, const std::vector<GlyphTelemetry> &glyphs) {
+    const size_t len = strlen(fname);
+    const bool json = len >= 5 && strcmp(fname + len - 5, ".json") == 0;
+    FILE *f = fopen(fname, "w");
+    if(!f) {
+        return false;
     }
-    if(!i.execute_program()) {
-        std::string err("Interpreter fail: ");
-        err += i.get_error();
-        return err;
+    if(json) {
+        fprintf(f, "[\n");
+    } else {
+        fprintf(f,
+                "glyph,stroke,phase,iteration,evaluations,line_search,objective,gradient_norm,"
+                "x_norm,step,seconds\n");
+    }
+    bool first = true;
+    for(const auto &g : glyphs) {
+        for(const auto &r : g.records) {
+            if(json) {
+                fprintf(f,
+                        "%s  {\"glyph\": \"%s\", \"stroke\": %d, \"phase\": \"%s\", "
+                        "\"iteration\": %d, \"evaluations\": %d, \"line_search\": %d, "
+                        "\"objective\": %.17g, \"gradient_norm\": %.17g, \"x_norm\": %.17g, "
+                        "\"step\": %.17g, \"seconds\": %.6f}",
+                        first ? "" : ",\n",
+                        g.glyph.c_str(),
+                        r.stroke,
+                        phase_name(r.phase),
+                        r.iteration,
+                        r.evaluations,
+                        r.line_search,
+                        r.objective,
+                        r.gradient_norm,
+                        r.x_norm,
+                        r.step,
+                        r.seconds);
+            } else {
+                fprintf(f,
+                        "%s,%d,%s,%d,%d,%d,%.17g,%.17g,%.17g,%.17g,%.6f\n",
+                        g.glyph.c_str(),
+                        r.stroke,
+                        phase_name(r.phase),
+                        r.iteration,
+                        r.evaluations,
+                        r.line_search,
+                        r.objective,
+                        r.gradient_norm,
+                        r.x_norm,
+                        r.step,
+                        r.seconds);
+            }
+            first = false;
+        }
     }
-    if(!b.has_shape()) {
-        return "Program did not define a bezier stroke.";
+    if(json) {
+        fprintf(f, "%s]\n", first ? "" : "\n");
     }
-    optimize(state, &b.get_shape());
-    return std::move(b.get_shape());
+    const bool ok = !ferror(f);
+    fclose(f);
+    return ok;
 }
 
-#if defined(WASM)
-
-// Store all evaluated frames here for the UI.
-
-static std::vector<std::string> frames;
-
-extern "C" {
-
-int EMSCRIPTEN_KEEPALIVE num_frames() {
-    return (int) frames.size();
+// Parses a list like w=0.5,r=0.05.
+bool parse_constants(const char *text, ProgramConstants &constants) {
+    std::string list(text);
+    size_t begin = 0;
+    while(begin <= list.size()) {
+        size_t end = list.find(',', begin);
+        if(end == std::string::npos) {
+            end = list.size();
+        }
+        const std::string item = list.substr(begin, end - begin);
+        const auto eq = item.find('=');
+        if(eq == 0 || eq == std::string::npos || eq + 1 == item.size()) {
+            return false;
+        }
+        char *value_end;
+        const double value = strtod(item.c_str() + eq + 1, &value_end);
+        if(*value_end != '\0') {
+            return false;
+        }
+        constants.emplace_back(item.substr(0, eq), value);
+        begin = end + 1;
+    }
+    return true;
 }
 
-void EMSCRIPTEN_KEEPALIVE get_frame(int num, char *buf) {
-    if(num < 0 || num > (int)frames.size()) {
-        return;
+// Parses name=from:to:count or name=a,b,c.
+bool parse_sweep_axis(const char *text, SweepAxis &axis) {
+    const char *eq = strchr(text, '=');
+    if(!eq || eq == text) {
+        return false;
+    }
+    axis.name = std::string(text, eq);
+    double from, to;
+    int count;
+    char end;
+    if(sscanf(eq + 1, "%lf:%lf:%d%c", &from, &to, &count, &end) == 3) {
+        if(count < 1) {
+            return false;
+        }
+        for(int i = 0; i < count; ++i) {
+            axis.values.push_back(count == 1 ? from : from + (to - from) * i / (count - 1));
+        }
+        return true;
+    }
+    for(const char *p = eq + 1;;) {
+        char *value_end;
+        axis.values.push_back(strtod(p, &value_end));
+        if(value_end == p || (*value_end != ',' && *value_end != '\0')) {
+            return false;
+        }
+        if(*value_end == '\0') {
+            return true;
+        }
+        p = value_end + 1;
     }
-    strcpy(buf, frames[num].c_str());
 }
 
-int EMSCRIPTEN_KEEPALIVE wasm_entrypoint(char *buf) {
-    OptimizerState state;
-    std::string program(buf);
-    auto s = calculate_sample_dynamically(state, program);
-    if(std::holds_alternative<std::string>(s)) {
-        strcpy(buf, std::get<std::string>(s).c_str());
-        return 1;
+// Parses a list of positive strides like 8,1.
+bool parse_sample_schedule(const char *text, std::vector<int> &strides) {
+    for(const char *p = text;;) {
+        char *value_end;
+        const long stride = strtol(p, &value_end, 10);
+        if(value_end == p || stride < 1 || (*value_end != ',' && *value_end != '\0')) {
+            return false;
+        }
+        strides.push_back((int)stride);
+        if(*value_end == '\0') {
+            return true;
+        }
+        p = value_end + 1;
     }
-    state.frames.push_back(build_svg(std::get<Shape>(s), state.phase));
-    strcpy(buf, state.frames.back().c_str());
-    frames = std::move(state.frames);
-    return 0;
-}
 }
 
-int main(int, char **) {
-    printf("Fonttoy Wasm initialized.\n");
+int run_sweep_mode(const char *infile,
+                   const std::vector<SweepAxis> &axes,
+                   const char *sheet_file,
+                   const OptimizerState &defaults,
+                   int num_threads) {
+    const auto start = std::chrono::steady_clock::now();
+    auto result = run_sweep(read_file(infile), axes, defaults, num_threads);
+    if(std::holds_alternative<std::string>(result)) {
+        printf("%s\n", std::get<std::string>(result).c_str());
+        return 1;
+    }
+    const auto &points = std::get<std::vector<SweepPoint>>(result);
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double solve_seconds = 0;
+    for(const auto &point : points) {
+        for(const auto &[name, value] : point.constants) {
+            printf("%s=%g ", name.c_str(), value);
+        }
+        if(std::holds_alternative<std::string>(point.result)) {
+            printf("failed: %s\n", std::get<std::string>(point.result).c_str());
+        } else {
+            printf("%.3f s\n", point.seconds);
+        }
+        solve_seconds += point.seconds;
+    }
+    printf("%d points in %.2f s, %.2f s of solving.\n", (int)points.size(), seconds, solve_seconds);
+    STAT_TIME(export_output);
+    const auto svg = contact_sheet_svg(points, axes.back().values.size());
+    FILE *f = fopen(sheet_file, "w");
+    if(!f) {
+        printf("Could not write %s.\n", sheet_file);
+        return 1;
+    }
+    fwrite(svg.c_str(), 1, svg.size(), f);
+    STAT_COUNT_N(bytes_written, svg.size());
+    fclose(f);
     return 0;
 }
 
-#else
-
-std::string read_file(const char *fname) {
-    FILE *f = fopen(fname, "r");
-    assert(f);
-    const int bufsize = 1000000;
-    // Must be heap allocated so no std::array.
-    std::unique_ptr<char[]> buf(new(char[bufsize]));
-    auto num_read = fread(buf.get(), 1, bufsize, f);
+int run_sensitivity(const char *infile,
+                    const char *names,
+                    const char *out_file,
+                    const OptimizerState &defaults) {
+    std::vector<std::string> constants;
+    std::string list(names);
+    for(size_t begin = 0; begin <= list.size();) {
+        size_t end = std::min(list.find(',', begin), list.size());
+        constants.push_back(list.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    auto result = compute_sensitivity(read_file(infile), constants, defaults);
+    if(std::holds_alternative<std::string>(result)) {
+        printf("%s\n", std::get<std::string>(result).c_str());
+        return 1;
+    }
+    STAT_TIME(export_output);
+    const auto json = std::get<Sensitivity>(result).to_json();
+    FILE *f = fopen(out_file, "w");
+    if(!f) {
+        printf("Could not write %s.\n", out_file);
+        return 1;
+    }
+    fwrite(json.c_str(), 1, json.size(), f);
+    STAT_COUNT_N(bytes_written, json.size());
     fclose(f);
-    return std::string(buf.get(), buf.get() + num_read);
+    return 0;
 }
 
-void print_frames(const std::vector<std::string> &frames) {
+int run_design_space(const char *infile,
+                     const DesignSpaceSettings &settings,
+                     const OptimizerState &defaults) {
+    const auto start = std::chrono::steady_clock::now();
+    auto result = build_design_space(read_file(infile), settings, defaults);
+    if(std::holds_alternative<std::string>(result)) {
+        printf("%s\n", std::get<std::string>(result).c_str());
+        return 1;
+    }
+    auto &instances = std::get<std::vector<DesignInstance>>(result);
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    STAT_TIME(export_output);
     char buf[256];
-    for(size_t i=0; i<frames.size(); i++) {
-        sprintf(buf, "frame%03d.svg", (int)i);
+    for(size_t i = 0; i < instances.size(); ++i) {
+        sprintf(buf, "instance%02d.svg", (int)i);
+        const auto svg = build_svg(instances[i].glyph, OptPhase::finished);
         FILE *f = fopen(buf, "w");
-        fwrite(frames[i].c_str(), 1, frames[i].size(), f);
+        if(!f) {
+            printf("Could not write %s.\n", buf);
+            return 1;
+        }
+        fwrite(svg.c_str(), 1, svg.size(), f);
+        STAT_COUNT_N(bytes_written, svg.size());
         fclose(f);
+        printf("%s:", buf);
+        for(const auto &[name, value] : instances[i].constants) {
+            printf(" %s=%g", name.c_str(), value);
+        }
+        printf("\n");
     }
+    printf("%d instances from %d masters in %.2f s.\n",
+           (int)instances.size(),
+           (int)settings.masters.size(),
+           seconds);
+    return 0;
 }
+
+void print_usage(const char *progname) {
+    printf("%s [options] <input file> [more input files]\n", progname);
+    printf("%s --server=socket|- [--workers=N]\n\n", progname);
+    printf("  --raster=out.pgm      render the final shape (single input only)\n");
+    printf("  --raster-size=64      raster image size in pixels\n");
+    printf("  --sdf-atlas=basename  write basename.pgm and basename.json\n");
+    printf("  --sdf-size=32         SDF pixels per em\n");
+    printf("  --sdf-range=4         SDF distance range in pixels\n");
+    printf("  --font=out.ttf        write all glyphs into a TrueType font\n");
+    printf("  --font-tolerance=1    cubic to quadratic tolerance in font units, >= 0.1\n");
+    printf("  --no-offset-guess     start side fits from the constraint defaults\n");
+    printf("  --direct-envelope     use the fitted pen envelope without side iterations\n");
+    printf("  --no-symmetry         solve symmetric strokes in full\n");
+    printf("  --threads=0           threads for independent strokes, 0 for one per core\n");
+    printf("  --stats[=file.json]   print counters and timers as JSON at exit\n");
+    printf("  --trace=trace.json    write a Chrome trace event timeline\n");
+    printf("  --telemetry=out.csv   write per iteration convergence data, .json for JSON\n");
+    printf("  --stop-window=N       stop when the objective improved less than\n");
+    printf("  --stop-delta=D        D relative to N iterations ago (default 1e-5)\n");
+    printf("  --stop-gradient=E     gradient norm tolerance (default 1e-5)\n");
+    printf("  --max-evaluations=N   objective evaluations per phase\n");
+    printf("  --phase-time=S        wall clock seconds per phase\n");
+    printf("  --phase-cache=dir     store phase results in dir and reuse unchanged phases\n");
+    printf("  --deadline=MS         return the best shape so far after MS milliseconds\n");
+    printf("  --sample-schedule=S   curvature sample strides of the skeleton, e.g. 8,1\n");
+    printf("  --master=w=0.7,r=0.05 a master of a design space, give two or more\n");
+    printf("  --instances=9         instances to interpolate between the masters\n");
+    printf("  --polish              optimize interpolated instances further\n");
+    printf("  --sweep=r=0.03:0.08:6 solve a grid of constant values, also r=0.03,0.05\n");
+    printf("  --sweep-sheet=out.svg contact sheet of the sweep (default sweep.svg)\n");
+    printf("  --sensitivity=w,e3    derivatives of the points with respect to constants\n");
+    printf("  --sensitivity-file=f  where to write them (default sensitivity.json)\n");
+    printf("  --multistart=K        solve skeletons from K starting points, keep the best\n");
+    printf("  --seed=1              seed of the multistart perturbations\n");
+    printf("  --server=path         serve requests on a Unix socket, - for stdin/stdout\n");
+    printf("  --workers=0           server worker threads, 0 for one per core\n");
+}
+
 int main(int argc, char **argv) {
-    SvgExporter e;
-    OptimizerState state;
-    if(argc != 2) {
-        printf("%s <input file>\n", argv[0]);
+    std::vector<const char *> infiles;
+    const char *raster_file = nullptr;
+    int raster_size = 64;
+    const char *sdf_atlas = nullptr;
+    SdfSettings sdf_settings;
+    const char *font_file = nullptr;
+    FontSettings font_settings;
+    bool use_offset_guess = true;
+    bool direct_envelope = false;
+    bool use_symmetry = true;
+    int num_threads = 0;
+    bool print_stats = false;
+    const char *stats_file = nullptr;
+    const char *trace_file = nullptr;
+    const char *telemetry_file = nullptr;
+    StoppingPolicy stopping;
+    bool stopping_ok = true;
+    int deadline_ms = 0;
+    const char *server_socket = nullptr;
+    ServerSettings server_settings;
+    const char *phase_cache_dir = nullptr;
+    DesignSpaceSettings design_space;
+    bool design_space_ok = true;
+    std::vector<SweepAxis> sweep_axes;
+    const char *sweep_sheet = "sweep.svg";
+    const char *sensitivity = nullptr;
+    const char *sensitivity_file = "sensitivity.json";
+    MultistartSettings multistart;
+    multistart.starts = 1;
+    std::vector<int> sample_strides;
+    for(int i = 1; i < argc; ++i) {
+        if(strncmp(argv[i], "--raster=", 9) == 0) {
+            raster_file = argv[i] + 9;
+        } else if(strncmp(argv[i], "--raster-size=", 14) == 0) {
+            raster_size = atoi(argv[i] + 14);
+        } else if(strncmp(argv[i], "--sdf-atlas=", 12) == 0) {
+            sdf_atlas = argv[i] + 12;
+        } else if(strncmp(argv[i], "--sdf-size=", 11) == 0) {
+            sdf_settings.pixels_per_em = atoi(argv[i] + 11);
+        } else if(strncmp(argv[i], "--sdf-range=", 12) == 0) {
+            sdf_settings.range = atof(argv[i] + 12);
+        } else if(strncmp(argv[i], "--font=", 7) == 0) {
+            font_file = argv[i] + 7;
+        } else if(strncmp(argv[i], "--font-tolerance=", 17) == 0) {
+            font_settings.tolerance = atof(argv[i] + 17) / font_settings.units_per_em;
+        } else if(strcmp(argv[i], "--no-offset-guess") == 0) {
+            use_offset_guess = false;
+        } else if(strcmp(argv[i], "--no-symmetry") == 0) {
+            use_symmetry = false;
+        } else if(strcmp(argv[i], "--direct-envelope") == 0) {
+            direct_envelope = true;
+        } else if(strcmp(argv[i], "--stats") == 0) {
+            print_stats = true;
+        } else if(strncmp(argv[i], "--stats=", 8) == 0) {
+            print_stats = true;
+            stats_file = argv[i] + 8;
+        } else if(strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_file = argv[i] + 8;
+        } else if(strncmp(argv[i], "--threads=", 10) == 0) {
+            num_threads = atoi(argv[i] + 10);
+        } else if(strncmp(argv[i], "--server=", 9) == 0) {
+            server_socket = argv[i] + 9;
+        } else if(strncmp(argv[i], "--workers=", 10) == 0) {
+            server_settings.num_workers = atoi(argv[i] + 10);
+        } else if(strncmp(argv[i], "--deadline=", 11) == 0) {
+            deadline_ms = atoi(argv[i] + 11);
+            stopping_ok = stopping_ok && deadline_ms > 0;
+        } else if(strncmp(argv[i], "--telemetry=", 12) == 0) {
+            telemetry_file = argv[i] + 12;
+        } else if(strncmp(argv[i], "--stop-window=", 14) == 0) {
+            stopping.window = atoi(argv[i] + 14);
+            stopping_ok = stopping_ok && *stopping.window > 0;
+        } else if(strncmp(argv[i], "--stop-delta=", 13) == 0) {
+            stopping.delta = atof(argv[i] + 13);
+            stopping_ok = stopping_ok && *stopping.delta >= 0;
+        } else if(strncmp(argv[i], "--stop-gradient=", 16) == 0) {
+            stopping.epsilon = atof(argv[i] + 16);
+            stopping_ok = stopping_ok && *stopping.epsilon >= 0;
+        } else if(strncmp(argv[i], "--max-evaluations=", 18) == 0) {
+            stopping.max_evaluations = atoi(argv[i] + 18);
+            stopping_ok = stopping_ok && *stopping.max_evaluations > 0;
+        } else if(strncmp(argv[i], "--sample-schedule=", 18) == 0) {
+            sample_strides.clear();
+            stopping_ok = stopping_ok && parse_sample_schedule(argv[i] + 18, sample_strides);
+        } else if(strncmp(argv[i], "--phase-cache=", 14) == 0) {
+            phase_cache_dir = argv[i] + 14;
+        } else if(strncmp(argv[i], "--phase-time=", 13) == 0) {
+            stopping.phase_time = atof(argv[i] + 13);
+            stopping_ok = stopping_ok && *stopping.phase_time > 0;
+        } else if(strncmp(argv[i], "--master=", 9) == 0) {
+            design_space.masters.emplace_back();
+            design_space_ok =
+                design_space_ok && parse_constants(argv[i] + 9, design_space.masters.back());
+        } else if(strncmp(argv[i], "--instances=", 12) == 0) {
+            design_space.num_instances = atoi(argv[i] + 12);
+        } else if(strcmp(argv[i], "--polish") == 0) {
+            design_space.polish = true;
+        } else if(strncmp(argv[i], "--sweep=", 8) == 0) {
+            sweep_axes.emplace_back();
+            design_space_ok = design_space_ok && parse_sweep_axis(argv[i] + 8, sweep_axes.back());
+        } else if(strncmp(argv[i], "--sweep-sheet=", 14) == 0) {
+            sweep_sheet = argv[i] + 14;
+        } else if(strncmp(argv[i], "--multistart=", 13) == 0) {
+            multistart.starts = atoi(argv[i] + 13);
+        } else if(strncmp(argv[i], "--seed=", 7) == 0) {
+            multistart.seed = strtoul(argv[i] + 7, nullptr, 10);
+        } else if(strncmp(argv[i], "--sensitivity=", 14) == 0) {
+            sensitivity = argv[i] + 14;
+        } else if(strncmp(argv[i], "--sensitivity-file=", 19) == 0) {
+            sensitivity_file = argv[i] + 19;
+        } else if(argv[i][0] != '-') {
+            infiles.push_back(argv[i]);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if(server_socket) {
+        if(!infiles.empty() || server_settings.num_workers < 0) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        Server server(server_settings);
+        return strcmp(server_socket, "-") == 0 ? run_stdio_server(server)
+                                               : run_socket_server(server, server_socket);
+    }
+    if(infiles.empty() || raster_size <= 0 || (raster_file && infiles.size() != 1) ||
+       sdf_settings.pixels_per_em <= 0 || sdf_settings.range <= 0 ||
+       font_settings.tolerance * font_settings.units_per_em < 0.1 || num_threads < 0 || !stopping_ok || !design_space_ok ||
+       multistart.starts < 1 ||
+       ((!design_space.masters.empty() || !sweep_axes.empty() || sensitivity) &&
+        infiles.size() != 1) ||
+       (!design_space.masters.empty() + !sweep_axes.empty() + (sensitivity != nullptr) > 1)) {
+        print_usage(argv[0]);
         return 1;
     }
-    std::string program = read_file(argv[1]);
-    auto s = calculate_sample_dynamically(state, program);
-    if(std::holds_alternative<std::string>(s)) {
-        printf("%s\n", std::get<std::string>(s).c_str());
-    } else {
-        state.frames.push_back(build_svg(std::get<Shape>(s), OptPhase::finished));
+    multistart.num_threads = num_threads;
+    if(trace_file) {
+        trace_start();
+    }
+    std::unique_ptr<PhaseCache> phase_cache;
+    if(phase_cache_dir) {
+        std::error_code ec;
+        std::filesystem::create_directories(phase_cache_dir, ec);
+        phase_cache = std::make_unique<PhaseCache>(1024, phase_cache_dir);
+    }
+    if(!design_space.masters.empty() || !sweep_axes.empty() || sensitivity) {
+        OptimizerState defaults;
+        defaults.use_offset_guess = use_offset_guess;
+        defaults.direct_envelope = direct_envelope;
+        defaults.use_symmetry = use_symmetry;
+        defaults.num_threads = num_threads;
+        defaults.stopping = stopping;
+        defaults.sample_strides = sample_strides;
+        defaults.phase_cache = phase_cache.get();
+        defaults.verbose = false;
+        defaults.keep_frames = false;
+        int rc;
+        if(sensitivity) {
+            rc = run_sensitivity(infiles[0], sensitivity, sensitivity_file, defaults);
+        } else if(!sweep_axes.empty()) {
+            rc = run_sweep_mode(infiles[0], sweep_axes, sweep_sheet, defaults, num_threads);
+        } else {
+            rc = run_design_space(infiles[0], design_space, defaults);
+        }
+        if(rc != 0) {
+            return 1;
+        }
+        if(trace_file && !trace_write(trace_file)) {
+            printf("Could not write trace to %s.\n", trace_file);
+            return 1;
+        }
+        if(print_stats && !write_stats(stats_file)) {
+            printf("Could not write stats to %s.\n", stats_file);
+            return 1;
+        }
+        return 0;
+    }
+    // Programs can take strokes from other glyphs with Component. A program
+    // that needs a glyph that is not solved yet is run again after it, so
+    // that every glyph is solved once, in dependency order.
+    ComponentGlyphs components;
+    for(const auto f : infiles) {
+        components.names.push_back(glyph_name(f));
+    }
+    components.solved.assign(infiles.size(), nullptr);
+    std::vector<std::unique_ptr<Glyph>> glyphs(infiles.size());
+    std::vector<GlyphTelemetry> telemetry;
+    std::vector<size_t> pending;
+    for(size_t i = 0; i < infiles.size(); ++i) {
+        pending.push_back(i);
+    }
+    while(!pending.empty()) {
+        std::vector<size_t> waiting;
+        for(const size_t i : pending) {
+            TraceSpan span("glyph", infiles[i]);
+            OptimizerState state;
+            state.use_offset_guess = use_offset_guess;
+            state.direct_envelope = direct_envelope;
+            state.use_symmetry = use_symmetry;
+            state.num_threads = num_threads;
+            state.stopping = stopping;
+            state.sample_strides = sample_strides;
+            state.record_telemetry = telemetry_file != nullptr;
+            state.phase_cache = phase_cache.get();
+            if(deadline_ms > 0) {
+                state.deadline =
+                    std::chrono::steady_clock::now() + std::chrono::milliseconds(deadline_ms);
+            }
+            std::string program = read_file(infiles[i]);
+            components.missing = -1;
+            MultistartReport report;
+            auto s = multistart.starts > 1
+                         ? optimize_multistart(state, program, multistart, &report, &components)
+                         : calculate_sample_dynamically(state, program, &components);
+            if(std::holds_alternative<std::string>(s)) {
+                if(components.missing >= 0) {
+                    waiting.push_back(i);
+                    continue;
+                }
+                printf("%s\n", std::get<std::string>(s).c_str());
+                if(infiles.size() > 1) {
+                    return 1;
+                }
+            } else {
+                glyphs[i] = std::make_unique<Glyph>(std::move(std::get<Glyph>(s)));
+                components.solved[i] = glyphs[i].get();
+                if(state.partial) {
+                    printf("Deadline reached, %s is not fully optimized.\n", infiles[i]);
+                }
+                if(multistart.starts > 1) {
+                    printf("Best of %d starts: %d, skeleton objective %f against %f from the "
+                           "first, %d abandoned, %d collapsed.\n",
+                           multistart.starts,
+                           report.best,
+                           report.objectives[report.best],
+                           report.objectives[0],
+                           (int)std::count(report.abandoned.begin(), report.abandoned.end(), true),
+                           (int)std::count(report.collapsed.begin(), report.collapsed.end(), true));
+                }
+                if(!state.reused_phases.empty()) {
+                    printf("Phases reused from the cache:");
+                    for(const auto &r : state.reused_phases) {
+                        printf(" %d/%s", r.stroke, phase_name(r.phase));
+                    }
+                    printf("\n");
+                }
+                STAT_TIME(export_output);
+                state.frames.push_back(build_svg(*glyphs[i], OptPhase::finished));
+                if(raster_file) {
+                    write_raster(*glyphs[i], raster_file, raster_size);
+                }
+            }
+            if(telemetry_file) {
+                telemetry.push_back(
+                    GlyphTelemetry{glyph_name(infiles[i]), std::move(state.telemetry)});
+            }
+            // Animation frames are only written for the first glyph.
+            if(i == 0) {
+                STAT_TIME(export_output);
+                print_frames(state.frames);
+            }
+        }
+        if(waiting.size() == pending.size()) {
+            printf("Components of %s form a cycle or refer to the glyph itself.\n",
+                   infiles[waiting.front()]);
+            return 1;
+        }
+        pending = std::move(waiting);
+    }
+    std::vector<SdfGlyph> sdf_glyphs;
+    std::vector<FontGlyph> font_glyphs;
+    for(size_t i = 0; i < infiles.size(); ++i) {
+        if(!glyphs[i]) {
+            continue;
+        }
+        STAT_TIME(export_output);
+        const auto name = glyph_name(infiles[i]);
+        if(sdf_atlas) {
+            sdf_glyphs.push_back(SdfGlyph{name, glyphs[i]->build_outline()});
+        }
+        if(font_file) {
+            font_glyphs.push_back(
+                FontGlyph{name, codepoint_for_name(name), glyphs[i]->build_contours()});
+        }
+    }
+    if(sdf_atlas) {
+        STAT_TIME(export_output);
+        TraceSpan span("write_sdf_atlas");
+        SdfAtlas atlas(sdf_glyphs, sdf_settings);
+        if(!atlas.write(sdf_atlas)) {
+            printf("Could not write SDF atlas %s.\n", sdf_atlas);
+            return 1;
+        }
+    }
+    if(font_file) {
+        STAT_TIME(export_output);
+        TraceSpan span("write_font");
+        if(!write_truetype_font(font_file, font_glyphs, font_settings)) {
+            printf("Could not write font %s.\n", font_file);
+            return 1;
+        }
+    }
+    if(telemetry_file && !write_telemetry(telemetry_file, telemetry)) {
+        printf("Could not write telemetry to %s.\n", telemetry_file);
+        return 1;
+    }
+    if(trace_file && !trace_write(trace_file)) {
+        printf("Could not write trace to %s.\n", trace_file);
+        return 1;
+    }
+    if(print_stats && !write_stats(stats_file)) {
+        printf("Could not write stats to %s.\n", stats_file);
+        return 1;
     }
-
-    print_frames(state.frames);
     printf("All done, bye-bye.\n");
     return 0;
 }
@@ -0,0 +1,233 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <multistart.hpp>
+#include <trace.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <random>
+#include <thread>
+
+namespace {
+
+std::vector<int> first_primes(int n) {
+    std::vector<int> primes;
+    for(int candidate = 2; (int)primes.size() < n; ++candidate) {
+        bool prime = true;
+        for(const int p : primes) {
+            if(p * p > candidate) {
+                break;
+            }
+            if(candidate % p == 0) {
+                prime = false;
+                break;
+            }
+        }
+        if(prime) {
+            primes.push_back(candidate);
+        }
+    }
+    return primes;
+}
+
+double radical_inverse(int index, int base) {
+    double result = 0.0;
+    double f = 1.0 / base;
+    for(; index > 0; index /= base) {
+        result += f * (index % base);
+        f /= base;
+    }
+    return result;
+}
+
+// The objective does not see the curvature at a control point that
+// coincides with its end point, so a stroke can reach a low value by
+// collapsing handles into corners.
+int count_collapsed_handles(const Stroke &s) {
+    int count = 0;
+    for(const auto &b : s.build_beziers()) {
+        const double chord = (b.p2() - b.p1()).length();
+        count += (b.c1() - b.p1()).length() < 0.01 * chord;
+        count += (b.c2() - b.p2()).length() < 0.01 * chord;
+    }
+    return count;
+}
+
+struct StartResult {
+    std::vector<double> objectives; // Per stroke.
+    std::vector<std::vector<double>> skeletons;
+    bool abandoned = false;
+    int collapsed = 0; // Handles.
+};
+
+} // namespace
+
+std::variant<Glyph, std::string> optimize_multistart(OptimizerState &state,
+                                                     const std::string &program,
+                                                     const MultistartSettings &settings,
+                                                     MultistartReport *report,
+                                                     ComponentGlyphs *components) {
+    TraceSpan span("optimize_multistart");
+    Lexer l(program);
+    Parser p(l);
+    if(!p.parse()) {
+        return "Parser fail: " + p.get_error();
+    }
+    // The variables of the skeletons as they would start without
+    // multistart.
+    std::vector<std::vector<double>> initial;
+    {
+        Bridge b;
+        b.set_components(components);
+        auto error = execute_parsed(p, b);
+        if(error) {
+            return *error;
+        }
+        for(auto &s : b.get_glyph().strokes) {
+            if(!s.is_component) {
+                s.skeleton.freeze(state.use_symmetry);
+            }
+            initial.push_back(s.is_component ? std::vector<double>{}
+                                             : s.skeleton.get_free_variables());
+        }
+    }
+    const int num_starts = std::max(1, settings.starts);
+    int dimensions = 0;
+    for(const auto &v : initial) {
+        dimensions += v.size();
+    }
+    const auto primes = first_primes(dimensions);
+    std::mt19937 gen(settings.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<double> shifts;
+    for(int d = 0; d < dimensions; ++d) {
+        shifts.push_back(uniform(gen));
+    }
+    auto start_point = [&](int k) {
+        auto vars = initial;
+        if(k == 0) {
+            return vars;
+        }
+        int d = 0;
+        for(auto &stroke_vars : vars) {
+            for(auto &v : stroke_vars) {
+                const double u = std::fmod(radical_inverse(k, primes[d]) + shifts[d], 1.0);
+                v += settings.amplitude * (2.0 * u - 1.0) * std::max(std::abs(v), 0.1);
+                ++d;
+            }
+        }
+        return vars;
+    };
+
+    std::vector<StartResult> results(num_starts);
+    std::vector<double> bounds;
+    auto run_start = [&](int k) {
+        Bridge b;
+        b.set_components(components);
+        execute_parsed(p, b);
+        auto start_state = state.settings();
+        start_state.verbose = false;
+        start_state.keep_frames = false;
+        start_state.phase_cache = nullptr; // Its key does not include the start.
+        start_state.num_threads = 1;
+        start_state.skeleton_only = true;
+        start_state.skeleton_bounds = bounds;
+        start_state.abandon_after = settings.abandon_after;
+        for(auto &v : start_point(k)) {
+            start_state.starts.push_back(StrokeStart{std::move(v), {}, {}});
+        }
+        optimize_program(start_state, b);
+        auto &result = results[k];
+        result.abandoned = start_state.abandoned;
+        for(auto &s : b.get_glyph().strokes) {
+            auto vars = s.is_component ? std::vector<double>{} : s.skeleton.get_free_variables();
+            result.objectives.push_back(s.is_component ? 0.0 : s.skeleton.calculate_value_for(vars));
+            result.skeletons.push_back(std::move(vars));
+            result.collapsed += count_collapsed_handles(s.skeleton);
+        }
+    };
+
+    run_start(0);
+    for(const double o : results[0].objectives) {
+        bounds.push_back(o * (1.0 + settings.margin));
+    }
+    std::atomic<int> next_start(1);
+    auto worker = [&]() {
+        for(int k = next_start++; k < num_starts; k = next_start++) {
+            run_start(k);
+        }
+    };
+    int num_threads = settings.num_threads;
+    if(num_threads <= 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::min(num_threads, num_starts - 1);
+    if(num_threads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> threads;
+        for(int i = 0; i < num_threads; ++i) {
+            threads.emplace_back(worker);
+        }
+        for(auto &t : threads) {
+            t.join();
+        }
+    }
+
+    // Ties go to the earlier start. Starts that collapsed more handles
+    // than the first one are not taken.
+    int best = 0;
+    std::vector<double> totals;
+    for(int k = 0; k < num_starts; ++k) {
+        double total = 0;
+        for(const double o : results[k].objectives) {
+            total += o;
+        }
+        totals.push_back(total);
+        const bool rejected =
+            results[k].abandoned || results[k].collapsed > results[0].collapsed;
+        if(!rejected && total < totals[best]) {
+            best = k;
+        }
+    }
+    if(report) {
+        report->best = best;
+        report->objectives = totals;
+        report->abandoned.clear();
+        report->collapsed.clear();
+        for(const auto &r : results) {
+            report->abandoned.push_back(r.abandoned);
+            report->collapsed.push_back(r.collapsed > results[0].collapsed);
+        }
+    }
+
+    // The sides of the best start only.
+    Bridge b;
+    b.set_components(components);
+    execute_parsed(p, b);
+    state.starts.clear();
+    for(auto &v : results[best].skeletons) {
+        state.starts.push_back(StrokeStart{std::move(v), {}, {}});
+    }
+    state.start_only = true;
+    optimize_program(state, b);
+    state.start_only = false;
+    return std::move(b.get_glyph());
+}
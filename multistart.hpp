@@ -0,0 +1,60 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <optimizer.hpp>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Solves the skeletons of a program from several starting points and
+// keeps the best, as the skeleton objective has poor local minima. The
+// first start is the usual one, the others perturb its free variables
+// along a randomly shifted Halton sequence. The first start is solved
+// before the others, which then run in parallel and are abandoned when
+// they are still far above its objective after a few iterations. Which
+// starts are abandoned does not depend on their timing, so the result
+// only depends on the seed. Starts whose skeletons end with more
+// handles collapsed onto their end points than the first one, corners
+// the objective does not see, are not taken.
+
+struct MultistartSettings {
+    int starts = 8;
+    unsigned seed = 1;
+    double amplitude = 0.5; // Perturbation relative to the value, or to 0.1 if larger.
+    double margin = 0.5;    // Starts this much above the first one are abandoned.
+    int abandon_after = 10; // Iterations.
+    int num_threads = 0;    // Zero means one per core.
+};
+
+struct MultistartReport {
+    int best = 0; // The start the result came from.
+    std::vector<double> objectives; // Skeleton objectives of all strokes, per start.
+    std::vector<bool> abandoned;
+    std::vector<bool> collapsed; // More handles of nearly zero length than the first.
+};
+
+// Like calculate_sample_dynamically, with the skeletons solved from
+// several starts.
+std::variant<Glyph, std::string> optimize_multistart(OptimizerState &state,
+                                                     const std::string &program,
+                                                     const MultistartSettings &settings,
+                                                     MultistartReport *report = nullptr,
+                                                     ComponentGlyphs *components = nullptr);
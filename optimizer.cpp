@@ -0,0 +1,1168 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _USE_MATH_DEFINES
+#define _USE_MATH_DEFINES
+#endif
+
+#include <optimizer.hpp>
+#include <constraints.hpp>
+#include <phasecache.hpp>
+#include <svgexporter.hpp>
+#include <stats.hpp>
+#include <trace.hpp>
+#include <lbfgs.h>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+static_assert(sizeof(lbfgsfloatval_t) == sizeof(double));
+
+typedef double (*fptr)(const double *, const int);
+
+double maxd(const double d1, const double d2) { return d1 > d2 ? d1 : d2; }
+
+const char *phase_name(OptPhase phase) {
+    switch(phase) {
+    case OptPhase::uninit:
+        return "uninit";
+    case OptPhase::skeleton:
+        return "skeleton";
+    case OptPhase::left:
+        return "left";
+    case OptPhase::right:
+        return "right";
+    case OptPhase::finished:
+        return "finished";
+    }
+    return "unknown";
+}
+
+void StoppingPolicy::override_with(const StoppingPolicy &other) {
+    if(other.window) {
+        window = other.window;
+    }
+    if(other.delta) {
+        delta = other.delta;
+    }
+    if(other.epsilon) {
+        epsilon = other.epsilon;
+    }
+    if(other.max_evaluations) {
+        max_evaluations = other.max_evaluations;
+    }
+    if(other.phase_time) {
+        phase_time = other.phase_time;
+    }
+}
+
+static void apply_stopping(const StoppingPolicy &policy, lbfgs_parameter_t &param) {
+    if(policy.window) {
+        param.past = *policy.window;
+    }
+    if(policy.delta) {
+        param.delta = *policy.delta;
+    }
+    if(policy.epsilon) {
+        param.epsilon = *policy.epsilon;
+    }
+}
+
+static double phase_seconds(const OptimizerState &state) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - state.phase_start)
+        .count();
+}
+
+// True if the work is cancelled or would not finish by the deadline if it
+// took margin more seconds.
+static bool out_of_time(const OptimizerState &state, double margin) {
+    if(state.cancel && state.cancel->is_cancelled()) {
+        return true;
+    }
+    return state.deadline &&
+           std::chrono::steady_clock::now() + std::chrono::duration<double>(margin) >=
+               *state.deadline;
+}
+
+static void start_phase(OptimizerState &state) {
+    state.evaluations = 0;
+    state.iterations = 0;
+    state.phase_start = std::chrono::steady_clock::now();
+    state.last_iteration = state.phase_start;
+    state.slowest_iteration = 0;
+    state.stopped_by = nullptr;
+}
+
+static void add_stopping(PhaseKey &key, const StoppingPolicy &policy) {
+    // None of the values can be negative.
+    key.add(policy.window ? *policy.window : -1.0);
+    key.add(policy.delta.value_or(-1.0));
+    key.add(policy.epsilon.value_or(-1.0));
+    key.add(policy.max_evaluations ? *policy.max_evaluations : -1.0);
+    key.add(policy.phase_time.value_or(-1.0));
+}
+
+// Called after freezing the stroke, before it is given starting values.
+static std::string stroke_phase_key(const Stroke &s, const OptimizerState &state) {
+    PhaseKey key(phase_name(state.phase));
+    key.add(s.structure_key());
+    std::vector<double> values;
+    s.append_parameters_to(values);
+    key.add(values);
+    key.add(s.get_free_variables());
+    add_stopping(key, state.stopping);
+    if(!state.sample_strides.empty()) {
+        key.add(std::vector<double>(state.sample_strides.begin(), state.sample_strides.end()));
+    }
+    return key.str();
+}
+
+// The side constraints are built from the skeleton and the pen.
+static std::string side_phase_key(const Shape &shape,
+                                  const Stroke &side,
+                                  const OptimizerState &state) {
+    PhaseKey key(stroke_phase_key(side, state));
+    std::vector<double> values;
+    for(const auto &p : shape.skeleton.get_points()) {
+        values.push_back(p.x());
+        values.push_back(p.y());
+    }
+    shape.pen.append_parameters_to(values);
+    values.push_back(state.use_offset_guess);
+    key.add(values);
+    return key.str();
+}
+
+// Takes the result of the phase from the cache if there is one.
+static bool reuse_phase(Stroke &s, const std::string &key, OptimizerState &state) {
+    auto cached = state.phase_cache->get(key);
+    if(!cached || cached->size() != s.get_free_variables().size()) {
+        return false;
+    }
+    start_phase(state);
+    s.calculate_value_for(*cached);
+    state.reused_phases.push_back(ReusedPhase{state.stroke_index, state.phase});
+    if(state.keep_frames) {
+        state.frames.push_back(build_svg(*state.s, state.phase));
+    }
+    if(state.verbose) {
+        printf("Phase %s reused from the cache.\n", phase_name(state.phase));
+    }
+    return true;
+}
+
+// A phase stopped by the clock would not give the same result again.
+static void store_phase(const std::string &key,
+                        const std::vector<double> &variables,
+                        const OptimizerState &state) {
+    if(state.stopped_by && strcmp(state.stopped_by, "evaluation limit") != 0) {
+        return;
+    }
+    state.phase_cache->put(key, variables);
+}
+
+// Point on the pen envelope of the given side at parameter t of a
+// skeleton segment.
+Point envelope_point(const Shape &s,
+                     const std::vector<Bezier> &skel_beziers,
+                     int bez_index,
+                     double t,
+                     OptPhase which) {
+    assert(which == OptPhase::left || which == OptPhase::right);
+    const auto &b = skel_beziers[bez_index];
+    const double stroke_t = (bez_index + t) / skel_beziers.size();
+    const auto direction = b.evaluate_d1(t);
+    const auto offset = which == OptPhase::left ? s.pen.left_offset(direction, stroke_t)
+                                                : s.pen.right_offset(direction, stroke_t);
+    return b.evaluate(t) + offset;
+}
+
+double distance_error(Shape *s, const std::vector<double> &x, OptPhase which) {
+    assert(which == OptPhase::left || which == OptPhase::right);
+    double total_error = 0;
+    auto skel_beziers = s->skeleton.build_beziers();
+    Stroke *side = which == OptPhase::left ? &s->left : &s->right;
+    side->set_free_variables(x);
+    auto side_beziers = side->build_beziers();
+    assert(skel_beziers.size() == side_beziers.size());
+    for(int bez_index = 0; bez_index < (int)skel_beziers.size(); ++bez_index) {
+        for(int i = 1; i < 4; ++i) {
+            double t = i / 4.0;
+            auto target_point = envelope_point(*s, skel_beziers, bez_index, t, which);
+            auto side_point = side_beziers[bez_index].evaluate(t);
+            STAT_COUNT(bezier_samples);
+            auto diff = side_point - target_point;
+            total_error += diff.dot(diff);
+        }
+    }
+    return total_error;
+}
+
+double OptimizerState::calculate_value_for(const std::vector<double> &x) const {
+    switch(phase) {
+    case OptPhase::skeleton:
+        STAT_COUNT(objective_skeleton);
+        return s->skeleton.calculate_value_for(x);
+    case OptPhase::left:
+        STAT_COUNT(objective_left);
+        return distance_error(s, x, phase);
+    case OptPhase::right:
+        STAT_COUNT(objective_right);
+        return distance_error(s, x, phase);
+    default:
+        assert(false);
+    }
+    return 0.0 / 0.0;
+}
+
+OptimizerState OptimizerState::settings() const {
+    OptimizerState state;
+    state.use_offset_guess = use_offset_guess;
+    state.direct_envelope = direct_envelope;
+    state.use_symmetry = use_symmetry;
+    state.num_threads = num_threads;
+    state.verbose = verbose;
+    state.keep_frames = keep_frames;
+    state.stopping = stopping;
+    state.record_telemetry = record_telemetry;
+    state.cancel = cancel;
+    state.deadline = deadline;
+    state.phase_cache = phase_cache;
+    state.abandon_after = abandon_after;
+    state.sample_strides = sample_strides;
+    return state;
+}
+
+std::vector<double> compute_absolute_step(double rel_step, const std::vector<double> &x) {
+    std::vector<double> h;
+    h.reserve(x.size());
+    for(size_t i = 0; i < x.size(); ++i) {
+        double sign_x = x[i] >= 0 ? 1.0 : -1.0;
+        h.push_back(rel_step * sign_x * maxd(1.0, fabs(x[i])));
+    }
+    return h;
+}
+
+std::vector<double> estimate_derivative(OptimizerState *args,
+                                        const std::vector<double> &x,
+                                        double f0,
+                                        const std::vector<double> &h) {
+    STAT_COUNT(gradient_evaluations);
+    std::vector<double> g(x.size());
+    std::vector<double> x0 = x;
+    for(size_t i = 0; i < x.size(); i++) {
+        double old_v = x0[i];
+        x0[i] += h[i];
+        double dx = h[i];
+        double df;
+        if(args->phase == OptPhase::skeleton) {
+            // Only re-evaluates the segments this variable moves.
+            STAT_COUNT(objective_skeleton);
+            df = args->s->skeleton.calculate_value_with(x, i, x0[i]) - f0;
+        } else {
+            df = args->calculate_value_for(x0) - f0;
+        }
+        g[i] = df / dx;
+        x0[i] = old_v;
+    }
+    return g;
+}
+
+void put_beziers_in(Stroke &s, SvgExporter &svg, bool draw_controls) {
+    for(const auto b : s.build_beziers()) {
+        svg.draw_bezier(b.p1(), b.c1(), b.c2(), b.p2(), draw_controls);
+    }
+}
+
+void draw_shape(Shape &s, SvgExporter &svg) {
+    auto left_beziers = s.left.build_beziers();
+    auto right_beziers = s.right.build_beziers();
+    svg.draw_shape(left_beziers, right_beziers);
+}
+
+
+void put_indexes_in(Stroke &s, SvgExporter &svg) {
+    char buf[1024];
+    auto &points = s.get_points();
+    for(int i = 0; i < (int)points.size(); i += 3) {
+        const auto &p = points[i];
+        const double label_x = p.x() - 0.006;
+        const double label_y = p.y() + 0.02;
+        sprintf(buf, "%d", i);
+        svg.draw_text(label_x, label_y, 0.02, buf);
+    }
+}
+
+void build_svg(Shape &s, SvgExporter &svg, OptPhase phase) {
+    if(phase == OptPhase::finished) {
+        draw_shape(s, svg);
+    }
+    put_beziers_in(s.skeleton, svg, true);
+    put_indexes_in(s.skeleton, svg);
+    if(phase == OptPhase::left || phase == OptPhase::right) {
+        put_beziers_in(s.left, svg, false);
+    }
+    if(phase == OptPhase::right) {
+        put_beziers_in(s.right, svg, false);
+    }
+}
+
+std::string build_svg(Shape &s, OptPhase phase) {
+    TraceSpan span("build_svg");
+    SvgExporter svg;
+    build_svg(s, svg, phase);
+    auto str = svg.to_string();
+    STAT_COUNT(svg_frames);
+    STAT_COUNT_N(svg_bytes, str.size());
+    return str;
+}
+
+std::string build_svg(Glyph &g, OptPhase phase) {
+    TraceSpan span("build_svg");
+    SvgExporter svg;
+    for(auto &s : g.strokes) {
+        build_svg(s, svg, phase);
+    }
+    auto str = svg.to_string();
+    STAT_COUNT(svg_frames);
+    STAT_COUNT_N(svg_bytes, str.size());
+    return str;
+}
+
+void write_svg(Shape &s, const char *fname, OptPhase phase) {
+    SvgExporter svg;
+    build_svg(s, svg, phase);
+    svg.write_svg(fname);
+}
+
+static lbfgsfloatval_t evaluate_model(void *instance,
+                                      const lbfgsfloatval_t *x,
+                                      lbfgsfloatval_t *g,
+                                      const int n,
+                                      const lbfgsfloatval_t step) {
+    TraceSpan span("evaluate_model");
+    auto args = reinterpret_cast<OptimizerState *>(instance);
+    (void)step;
+    const double rel_step = 0.000000001;
+    std::vector<double> curx(x, x + n);
+    ++args->evaluations;
+    double fx = args->calculate_value_for(curx);
+    if(args->keep_frames) {
+        args->frames.push_back(build_svg(*args->s, args->phase));
+    }
+    auto curh = compute_absolute_step(rel_step, curx);
+    auto g_est = estimate_derivative(args, curx, fx, curh);
+    for(int i = 0; i < n; i++) {
+        g[i] = g_est[i];
+    }
+    if(args->verbose) {
+        printf("Evaluation: %f\n", fx);
+    }
+    return fx;
+}
+
+int model_progress(void *instance,
+                   const lbfgsfloatval_t *,
+                   const lbfgsfloatval_t *,
+                   const lbfgsfloatval_t fx,
+                   const lbfgsfloatval_t xnorm,
+                   const lbfgsfloatval_t gnorm,
+                   const lbfgsfloatval_t step,
+                   int,
+                   int k,
+                   int ls) {
+    auto *args = reinterpret_cast<OptimizerState *>(instance);
+    if(args->verbose) {
+        printf("Iteration %d\n", k);
+    }
+    args->iterations = k;
+    if(args->keep_frames) {
+        args->frames.push_back(build_svg(*args->s, args->phase));
+    }
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = phase_seconds(*args);
+    args->slowest_iteration = std::max(
+        args->slowest_iteration, std::chrono::duration<double>(now - args->last_iteration).count());
+    args->last_iteration = now;
+    if(args->record_telemetry) {
+        args->telemetry.push_back(IterationRecord{args->stroke_index,
+                                                  args->phase,
+                                                  k,
+                                                  args->evaluations,
+                                                  ls,
+                                                  fx,
+                                                  gnorm,
+                                                  xnorm,
+                                                  step,
+                                                  elapsed});
+    }
+    // A nonzero return value makes lbfgs stop and return it. Stopping
+    // before an iteration that would probably end past the deadline keeps
+    // the response time within it.
+    if(out_of_time(*args, args->slowest_iteration)) {
+        args->stopped_by = args->cancel && args->cancel->is_cancelled() ? "cancellation"
+                                                                        : "deadline";
+        args->partial = true;
+        return 1;
+    }
+    if(args->phase == OptPhase::skeleton && k >= args->abandon_after &&
+       fx > args->skeleton_bound) {
+        args->stopped_by = "skeleton bound";
+        args->abandoned = true;
+        return 1;
+    }
+    const auto &policy = args->stopping;
+    if(policy.max_evaluations && args->evaluations >= *policy.max_evaluations) {
+        args->stopped_by = "evaluation limit";
+        return 1;
+    }
+    if(policy.phase_time && elapsed >= *policy.phase_time) {
+        args->stopped_by = "time limit";
+        return 1;
+    }
+    return 0;
+}
+
+void optimize_skeleton(Shape *shape, OptimizerState &state) {
+    assert(state.phase == OptPhase::skeleton);
+    TraceSpan span("optimize_skeleton");
+    state.s = shape;
+    Stroke *s = &shape->skeleton;
+    double final_result = 1e8;
+    s->freeze(state.use_symmetry);
+    if(s->get_symmetry() && state.verbose) {
+        printf("Skeleton is symmetric, solving one half.\n");
+    }
+    auto variables = s->get_free_variables();
+    const bool have_start = state.start && state.start->skeleton.size() == variables.size();
+    if(have_start && state.start_only) {
+        s->calculate_value_for(state.start->skeleton);
+        return;
+    }
+    std::string cache_key;
+    if(state.phase_cache) {
+        cache_key = stroke_phase_key(*s, state);
+        if(reuse_phase(*s, cache_key, state)) {
+            return;
+        }
+    }
+    if(have_start) {
+        variables = state.start->skeleton;
+    }
+
+    s->calculate_value_for(variables);
+    if(state.keep_frames) {
+        state.frames.push_back(build_svg(*shape, state.phase));
+    }
+    start_phase(state);
+
+    int ret = LBFGSERR_CANCELED;
+    if(out_of_time(state, 0)) {
+        state.partial = true;
+    } else {
+        const std::vector<int> strides =
+            state.sample_strides.empty() ? std::vector<int>{1} : state.sample_strides;
+        int iterations = 0;
+        for(size_t level = 0; level < strides.size(); ++level) {
+            lbfgs_parameter_t param;
+            lbfgs_parameter_init(&param);
+            apply_stopping(state.stopping, param);
+            s->set_sample_stride(strides[level]);
+            const int evaluations = state.evaluations;
+            const auto level_start = std::chrono::steady_clock::now();
+            state.iterations = 0;
+            ret = lbfgs(variables.size(),
+                        &variables[0],
+                        &final_result,
+                        evaluate_model,
+                        model_progress,
+                        &state,
+                        &param);
+            iterations += state.iterations;
+            if(!state.sample_strides.empty()) {
+                state.sampling_levels.push_back(SamplingLevelRecord{
+                    state.stroke_index,
+                    strides[level],
+                    state.iterations,
+                    state.evaluations - evaluations,
+                    std::chrono::duration<double>(std::chrono::steady_clock::now() - level_start)
+                        .count(),
+                    final_result,
+                    false});
+            }
+            if(state.stopped_by || level + 1 == strides.size()) {
+                break;
+            }
+            // Sparse samples are a subset of all of them, so their maximum
+            // is a lower bound of the full objective. Where it is tight at
+            // its minimum, that is a minimum of the full objective too and
+            // the finer levels would not move from it.
+            const double bound = s->calculate_value_for(variables);
+            s->set_sample_stride(1);
+            if(s->calculate_value_for(variables) <= bound) {
+                state.sampling_levels.back().bound_tight = true;
+                break;
+            }
+        }
+        state.iterations = iterations;
+        s->set_sample_stride(1);
+        if(state.phase_cache) {
+            store_phase(cache_key, variables, state);
+        }
+    }
+    // insert final values back in the stroke here.
+    s->calculate_value_for(variables);
+    if(state.verbose) {
+        printf("Skeleton exit value: %d\n", ret);
+        if(state.stopped_by) {
+            printf("Skeleton stopped by the %s.\n", state.stopped_by);
+        }
+        printf("Skeleton iterations: %d, evaluations: %d\n", state.iterations, state.evaluations);
+        for(const auto &l : state.sampling_levels) {
+            printf("Every %d. sample: iterations %d, evaluations %d, %.3f s, objective %f%s\n",
+                   l.stride,
+                   l.iterations,
+                   l.evaluations,
+                   l.seconds,
+                   l.objective,
+                   l.bound_tight ? ", exact" : "");
+        }
+        const auto &cache = s->get_cache_stats();
+        const long long lookups = cache.hits + cache.misses;
+        printf("Segment cache: %lld hits, %lld misses, hit rate %.1f%%\n",
+               cache.hits,
+               cache.misses,
+               lookups ? 100.0 * cache.hits / lookups : 0.0);
+    }
+}
+
+Vector unit_tangent(const Bezier &b, double t) {
+    auto d1 = b.evaluate_d1(t);
+    return d1 * (1.0 / d1.length());
+}
+
+// Starting point for a side stroke: the pen envelope along the
+// skeleton, fitted into the form the side's constraints can express.
+// On-curve points are already fixed and the handle directions follow
+// the skeleton tangents, so only the two handle lengths of each segment
+// are unknown and the least squares fit to the envelope is linear.
+std::vector<Point> offset_guess(const Shape &shape,
+                                const std::vector<Bezier> &skel_b,
+                                const std::vector<Point> &on_curve,
+                                OptPhase which) {
+    const int num_samples = 7;
+    std::vector<Point> target(on_curve);
+    for(int i = 0; i < (int)skel_b.size(); ++i) {
+        const auto &b = skel_b[i];
+        const Point &p0 = on_curve[3 * i];
+        const Point &p3 = on_curve[3 * i + 3];
+        const Vector u0 = unit_tangent(b, 0.0);
+        const Vector u3 = i + 1 < (int)skel_b.size() ? unit_tangent(skel_b[i + 1], 0.0)
+                                                     : unit_tangent(b, 1.0);
+        double aa = 0, ac = 0, cc = 0, ar = 0, cr = 0;
+        for(int k = 1; k <= num_samples; ++k) {
+            const double t = double(k) / (num_samples + 1);
+            const double mt = 1.0 - t;
+            const double b1 = 3.0 * mt * mt * t;
+            const double b2 = 3.0 * mt * t * t;
+            const Point offset_point = envelope_point(shape, skel_b, i, t, which);
+            // Weights of the fixed on-curve points, handles included.
+            const double w0 = mt * mt * mt + b1;
+            const double w3 = b2 + t * t * t;
+            const Vector residual(offset_point.x() - w0 * p0.x() - w3 * p3.x(),
+                                  offset_point.y() - w0 * p0.y() - w3 * p3.y());
+            const Vector a = u0 * b1;
+            const Vector c = u3 * (-b2);
+            aa += a.dot(a);
+            ac += a.dot(c);
+            cc += c.dot(c);
+            ar += a.dot(residual);
+            cr += c.dot(residual);
+        }
+        const double det = aa * cc - ac * ac;
+        const double fallback = (p3 - p0).length() / 3.0;
+        double d1 = fallback, d2 = fallback;
+        if(fabs(det) > 1e-12) {
+            d1 = (ar * cc - cr * ac) / det;
+            d2 = (cr * aa - ar * ac) / det;
+        }
+        // Handles can not point backwards. Pin the offending one to zero
+        // and refit the other one alone.
+        if(d1 < 0.0 && cc > 0.0) {
+            d1 = 0.0;
+            d2 = cr / cc;
+        } else if(d2 < 0.0 && aa > 0.0) {
+            d2 = 0.0;
+            d1 = ar / aa;
+        }
+        if(!(d1 >= 0.0) || !(d2 >= 0.0)) {
+            d1 = d2 = fallback;
+        }
+        target[3 * i + 1] = p0 + u0 * d1;
+        target[3 * i + 2] = p3 - u3 * d2;
+    }
+    return target;
+}
+
+void optimize_side(Shape *shape, OptimizerState &state) {
+    TraceSpan span(state.phase == OptPhase::left ? "optimize_side left" : "optimize_side right");
+    Stroke *skel = &shape->skeleton;
+    double final_result = 1e8;
+    state.s = shape;
+    auto skel_b = skel->build_beziers();
+    auto side = state.phase == OptPhase::left ? &shape->left : &shape->right;
+    const auto &skel_points = skel->get_points();
+    const auto &side_points = side->get_points();
+    assert(skel_points.size() == side_points.size());
+    std::vector<Point> on_curve(side_points.size());
+
+    // Each side point is at a fixed location w.r.t. to the skeleton point.
+    for(int i = 0; i < (int)skel_points.size(); i += 3) {
+        int bezier_index, eval_point;
+        if(i == (int)skel_points.size() - 1) {
+            bezier_index = (int)skel_b.size() - 1;
+            eval_point = 1.0;
+        } else {
+            bezier_index = i / 3;
+            eval_point = 0.0;
+        }
+        Point side_point = envelope_point(*shape, skel_b, bezier_index, eval_point, state.phase);
+        on_curve[i] = side_point;
+        auto rc = side->add_constraint(std::make_unique<FixedConstraint>(i, side_point));
+        assert(!rc);
+    }
+
+    // Each control point _after_ a fixed point defines the direction.
+    // Each control point _before_ a fixed point defines smoothness.
+    // The very last point is special in each case.
+    for(int i = 0; i < (int)skel_b.size(); ++i) {
+        auto direction = skel_b[i].evaluate_d1(0.0);
+        auto theta = direction.angle();
+        auto rc =
+            side->add_constraint(std::make_unique<DirectionConstraint>(i * 3, i * 3 + 1, theta));
+        assert(!rc);
+    }
+    auto backwards_angle = skel_b.back().evaluate_d1(1.0).angle() + M_PI;
+    auto rc = side->add_constraint(std::make_unique<DirectionConstraint>(
+        skel_points.size() - 1, skel_points.size() - 2, backwards_angle));
+    assert(!rc);
+
+    for(int i = 1; i < (int)skel_b.size(); ++i) {
+        int middle_curve_point = 3 * i;
+        int this_control_index = 3 * i - 1;
+        int other_control_index = 3 * i + 1;
+        auto rc = side->add_constraint(std::make_unique<SmoothConstraint>(
+            this_control_index, other_control_index, middle_curve_point));
+        assert(!rc);
+    }
+
+    side->freeze(state.use_symmetry);
+    // A cached result is better than the envelope when out of time, but
+    // not when the envelope itself was asked for.
+    std::string cache_key;
+    if(state.phase_cache && !state.direct_envelope) {
+        cache_key = side_phase_key(*shape, *side, state);
+        if(reuse_phase(*side, cache_key, state)) {
+            return;
+        }
+    }
+    const bool direct_envelope = state.direct_envelope || out_of_time(state, 0);
+    if(direct_envelope && !state.direct_envelope) {
+        state.partial = true;
+    }
+    if(state.use_offset_guess || direct_envelope) {
+        side->fit_to(offset_guess(*shape, skel_b, on_curve, state.phase));
+    }
+    auto variables = side->get_free_variables();
+    if(state.start && !direct_envelope) {
+        const auto &start = state.phase == OptPhase::left ? state.start->left : state.start->right;
+        if(start.size() == variables.size() && state.start_only) {
+            side->calculate_value_for(start);
+            return;
+        }
+        if(start.size() == variables.size() &&
+           state.calculate_value_for(start) < state.calculate_value_for(variables)) {
+            variables = start;
+        }
+    }
+    start_phase(state);
+    if(direct_envelope) {
+        const double error = state.calculate_value_for(variables);
+        if(state.verbose) {
+            printf("Side taken from the pen envelope, error %f\n", error);
+        }
+        return;
+    }
+
+    lbfgs_parameter_t param;
+    lbfgs_parameter_init(&param);
+    apply_stopping(state.stopping, param);
+    int ret = lbfgs(variables.size(),
+                    &variables[0],
+                    &final_result,
+                    evaluate_model,
+                    model_progress,
+                    &state,
+                    &param);
+    if(state.phase_cache) {
+        store_phase(cache_key, variables, state);
+    }
+    side->calculate_value_for(variables);
+    if(state.verbose) {
+        printf("Side exit value: %d\n", ret);
+        if(state.stopped_by) {
+            printf("Side stopped by the %s.\n", state.stopped_by);
+        }
+        printf("Side iterations: %d, evaluations: %d\n", state.iterations, state.evaluations);
+    }
+}
+
+void optimize(OptimizerState &state, Shape *shape) {
+    assert(state.phase == OptPhase::uninit);
+    state.phase = OptPhase::skeleton;
+    {
+        STAT_TIME(skeleton);
+        optimize_skeleton(shape, state);
+    }
+    if(state.skeleton_only) {
+        state.phase = OptPhase::finished;
+        return;
+    }
+    state.phase = OptPhase::left;
+    {
+        STAT_TIME(left);
+        optimize_side(shape, state);
+    }
+    state.phase = OptPhase::right;
+    {
+        STAT_TIME(right);
+        optimize_side(shape, state);
+    }
+    state.phase = OptPhase::finished;
+}
+
+// Every group of connected strokes is an independent problem. Groups are
+// handed out to the worker threads one at a time; within a group the
+// strokes are solved in order so that attached points are final by the
+// time the strokes that use them start.
+void optimize(OptimizerState &state, Glyph &glyph) {
+    const auto components = glyph.components();
+    std::vector<std::vector<std::string>> component_frames(components.size());
+    std::vector<std::vector<IterationRecord>> component_telemetry(components.size());
+    std::vector<std::vector<ReusedPhase>> component_reused(components.size());
+    std::vector<std::vector<SamplingLevelRecord>> component_levels(components.size());
+    std::atomic<int> next_component(0);
+    std::atomic<bool> any_partial(false);
+    std::atomic<bool> any_abandoned(false);
+    auto worker = [&]() {
+        for(int c = next_component++; c < (int)components.size(); c = next_component++) {
+            for(const int stroke_index : components[c]) {
+                Shape &shape = glyph.strokes[stroke_index];
+                if(shape.is_component) {
+                    continue;
+                }
+                for(const int other : shape.skeleton.attached_strokes()) {
+                    shape.skeleton.attach_to(other, glyph.strokes[other].skeleton);
+                }
+                auto stroke_state = state.settings();
+                stroke_state.start_only = state.start_only;
+                stroke_state.skeleton_only = state.skeleton_only;
+                if(stroke_index < (int)state.skeleton_bounds.size()) {
+                    stroke_state.skeleton_bound = state.skeleton_bounds[stroke_index];
+                }
+                if(stroke_index < (int)state.starts.size()) {
+                    stroke_state.start = &state.starts[stroke_index];
+                }
+                stroke_state.stroke_index = stroke_index;
+                optimize(stroke_state, &shape);
+                if(stroke_state.partial) {
+                    any_partial = true;
+                }
+                if(stroke_state.abandoned) {
+                    any_abandoned = true;
+                }
+                auto &frames = component_frames[c];
+                frames.insert(frames.end(),
+                              std::make_move_iterator(stroke_state.frames.begin()),
+                              std::make_move_iterator(stroke_state.frames.end()));
+                auto &telemetry = component_telemetry[c];
+                telemetry.insert(
+                    telemetry.end(), stroke_state.telemetry.begin(), stroke_state.telemetry.end());
+                auto &reused = component_reused[c];
+                reused.insert(reused.end(),
+                              stroke_state.reused_phases.begin(),
+                              stroke_state.reused_phases.end());
+                auto &levels = component_levels[c];
+                levels.insert(levels.end(),
+                              stroke_state.sampling_levels.begin(),
+                              stroke_state.sampling_levels.end());
+            }
+        }
+    };
+    int num_threads = state.num_threads;
+    if(num_threads <= 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::min(num_threads, (int)components.size());
+    if(num_threads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> threads;
+        for(int i = 0; i < num_threads; ++i) {
+            threads.emplace_back(worker);
+        }
+        for(auto &t : threads) {
+            t.join();
+        }
+    }
+    for(auto &frames : component_frames) {
+        state.frames.insert(state.frames.end(),
+                            std::make_move_iterator(frames.begin()),
+                            std::make_move_iterator(frames.end()));
+    }
+    for(const auto &telemetry : component_telemetry) {
+        state.telemetry.insert(state.telemetry.end(), telemetry.begin(), telemetry.end());
+    }
+    for(const auto &reused : component_reused) {
+        state.reused_phases.insert(state.reused_phases.end(), reused.begin(), reused.end());
+    }
+    for(const auto &levels : component_levels) {
+        state.sampling_levels.insert(state.sampling_levels.end(), levels.begin(), levels.end());
+    }
+    state.partial = state.partial || any_partial;
+    state.abandoned = state.abandoned || any_abandoned;
+    state.phase = OptPhase::finished;
+}
+
+const char *Bridge::current_error() const {
+    if(glyph.strokes.empty()) {
+        return "Stroke not set.";
+    }
+    if(glyph.strokes.back().is_component) {
+        return "The current stroke is a component.";
+    }
+    return nullptr;
+}
+
+funcall_result Bridge::funcall(const std::string &funname, const std::vector<double> &args) {
+    if(funname == "Stroke") {
+        if(args.size() != 1) {
+            return "Wrong number of arguments.";
+        }
+        if(args[0] < 1 || args[0] != (int)args[0]) {
+            return "Number of beziers must be a positive integer.";
+        }
+        glyph.strokes.emplace_back((int)args[0]);
+        return double(glyph.strokes.size() - 1);
+    } else if(funname == "PenCircle") {
+        if(auto error = current_error()) {
+            return error;
+        }
+        if(args.size() != 1) {
+            return "Wrong number of arguments.";
+        }
+        if(args[0] <= 0) {
+            return "Pen radius must be positive.";
+        }
+        current().pen = Pen(args[0], args[0], 0.0);
+        return 0.0;
+    } else if(funname == "PenEllipse") {
+        if(auto error = current_error()) {
+            return error;
+        }
+        if(args.size() != 3) {
+            return "Wrong number of arguments.";
+        }
+        if(args[0] <= 0 || args[1] <= 0) {
+            return "Pen radius must be positive.";
+        }
+        current().pen = Pen(args[0], args[1], args[2]);
+        return 0.0;
+    } else if(funname == "PenWidth") {
+        if(auto error = current_error()) {
+            return error;
+        }
+        if(args.empty()) {
+            return "Wrong number of arguments.";
+        }
+        for(const auto w : args) {
+            if(w < 0) {
+                return "Pen width must not be negative.";
+            }
+        }
+        current().pen.set_widths(args);
+        return 0.0;
+    } else if(funname == "FixedConstraint") {
+        if(auto error = current_error()) {
+            return error;
+        }
+        if(args.size() != 3) {
+            return "Wrong number of arguments.";
+        }
+        auto r = current().skeleton.add_constraint(
+            std::make_unique<FixedConstraint>(args[0], Point(args[1], args[2])));
+        if(r) {
+            return *r;
+        }
+        return 0.0;
+    } else if(funname == "DirectionConstraint") {
+        if(auto error = current_error()) {
+            return error;
+        }
+        if(args.size() != 3) {
+            return "Wrong number of arguments.";
+        }
+        auto r = current().skeleton.add_constraint(
+            std::make_unique<DirectionConstraint>(args[0], args[1], args[2]));
+        if(r) {
+            return *r;
+        }
+        return 0.0;
+    } else if(funname == "MirrorConstraint") {
+        if(auto error = current_error()) {
+            return error;
+        }
+        if(args.size() != 3) {
+            return "Wrong number of arguments.";
+        }
+        auto r = current().skeleton.add_constraint(
+            std::make_unique<MirrorConstraint>(args[0], args[1], args[2]));
+        if(r) {
+            return *r;
+        }
+        return 0.0;
+    } else if(funname == "SmoothConstraint") {
+        if(auto error = current_error()) {
+            return error;
+        }
+        if(args.size() != 3) {
+            return "Wrong number of arguments.";
+        }
+        auto r = current().skeleton.add_constraint(
+            std::make_unique<SmoothConstraint>(args[0], args[1], args[2]));
+        if(r) {
+            return *r;
+        }
+        return 0.0;
+    } else if(funname == "AngleConstraint") {
+        if(auto error = current_error()) {
+            return error;
+        }
+        if(args.size() != 4) {
+            return "Wrong number of arguments.";
+        }
+        auto r = current().skeleton.add_constraint(
+            std::make_unique<AngleConstraint>(args[0], args[1], args[2], args[3]));
+        if(r) {
+            return *r;
+        }
+        return 0.0;
+    } else if(funname == "SameOffsetConstraint") {
+        if(auto error = current_error()) {
+            return error;
+        }
+        if(args.size() != 4) {
+            return "Wrong number of arguments.";
+        }
+        auto r = current().skeleton.add_constraint(
+            std::make_unique<SameOffsetConstraint>(args[0], args[1], args[2], args[3]));
+        if(r) {
+            return *r;
+        }
+        return 0.0;
+    } else if(funname == "ReflectConstraint") {
+        if(auto error = current_error()) {
+            return error;
+        }
+        if(args.size() != 5) {
+            return "Wrong number of arguments.";
+        }
+        auto r = current().skeleton.add_constraint(std::make_unique<ReflectConstraint>(
+            args[0], args[1], Point(args[2], args[3]), args[4]));
+        if(r) {
+            return *r;
+        }
+        return 0.0;
+    } else if(funname == "AttachConstraint") {
+        if(auto error = current_error()) {
+            return error;
+        }
+        if(args.size() != 3) {
+            return "Wrong number of arguments.";
+        }
+        const int other = (int)args[1];
+        if(other != args[1] || other < 0 || other + 1 >= (int)glyph.strokes.size()) {
+            return "Can only attach to an earlier stroke.";
+        }
+        if(args[2] < 0 || args[2] >= glyph.strokes[other].skeleton.num_points()) {
+            return "Attached point index out of range.";
+        }
+        auto r = current().skeleton.add_constraint(
+            std::make_unique<AttachConstraint>(args[0], other, args[2]));
+        if(r) {
+            return *r;
+        }
+        return 0.0;
+    } else if(funname == "Component") {
+        if(args.size() != 8) {
+            return "Wrong number of arguments.";
+        }
+        if(!components) {
+            return "No glyphs to take components from.";
+        }
+        const int index = (int)args[0];
+        if(index != args[0] || index < 0 || index >= (int)components->solved.size()) {
+            return "Component glyph index out of range.";
+        }
+        const Glyph *source = components->solved[index];
+        if(!source) {
+            components->missing = index;
+            return "Component glyph is not solved yet.";
+        }
+        const int stroke = (int)args[1];
+        if(stroke != args[1] || stroke < 0 || stroke >= (int)source->strokes.size()) {
+            return "Component stroke index out of range.";
+        }
+        AffineTransform t;
+        t.a = args[2];
+        t.b = args[3];
+        t.c = args[4];
+        t.d = args[5];
+        t.dx = args[6];
+        t.dy = args[7];
+        glyph.strokes.push_back(source->strokes[stroke].transformed(t));
+        return double(glyph.strokes.size() - 1);
+    } else if(funname == "StopImprovement") {
+        if(args.size() != 2) {
+            return "Wrong number of arguments.";
+        }
+        if(args[0] < 1 || args[0] != (int)args[0] || args[1] < 0) {
+            return "Improvement window must be a positive integer and delta not negative.";
+        }
+        stopping.window = (int)args[0];
+        stopping.delta = args[1];
+        return 0.0;
+    } else if(funname == "StopGradient") {
+        if(args.size() != 1) {
+            return "Wrong number of arguments.";
+        }
+        if(args[0] < 0) {
+            return "Gradient tolerance must not be negative.";
+        }
+        stopping.epsilon = args[0];
+        return 0.0;
+    } else if(funname == "StopEvaluations") {
+        if(args.size() != 1) {
+            return "Wrong number of arguments.";
+        }
+        if(args[0] < 1 || args[0] != (int)args[0]) {
+            return "Evaluation limit must be a positive integer.";
+        }
+        stopping.max_evaluations = (int)args[0];
+        return 0.0;
+    } else if(funname == "StopTime") {
+        if(args.size() != 1) {
+            return "Wrong number of arguments.";
+        }
+        if(args[0] <= 0) {
+            return "Time limit must be positive.";
+        }
+        stopping.phase_time = args[0];
+        return 0.0;
+    } else {
+        return "Unknown function.";
+    }
+    return 0.0;
+}
+
+std::optional<std::string> execute_parsed(const Parser &p, Bridge &b, ProgramConstants *values) {
+    Interpreter i(p, &b);
+    if(const auto *c = b.get_components()) {
+        for(size_t g = 0; g < c->names.size(); ++g) {
+            i.define_variable("glyph_" + c->names[g], g);
+        }
+    }
+    for(const auto &[name, value] : b.get_constants()) {
+        i.override_variable(name, value);
+    }
+    bool executed;
+    {
+        STAT_TIME(interpret);
+        executed = i.execute_program();
+    }
+    if(!executed) {
+        std::string err("Interpreter fail: ");
+        err += i.get_error();
+        return err;
+    }
+    const auto unused = i.unused_overrides();
+    if(!unused.empty()) {
+        return "Program has no constant named " + unused.front() + ".";
+    }
+    if(values) {
+        for(auto &[name, value] : *values) {
+            const auto v = i.get_variable(name);
+            if(!v) {
+                return "Program has no constant named " + name + ".";
+            }
+            value = *v;
+        }
+    }
+    if(!b.has_shape()) {
+        return std::string("Program did not define a bezier stroke.");
+    }
+    return std::optional<std::string>{};
+}
+
+void optimize_program(OptimizerState &state, Bridge &b) {
+    // Settings given by the caller win over those of the program.
+    StoppingPolicy stopping = b.get_stopping();
+    stopping.override_with(state.stopping);
+    state.stopping = stopping;
+    optimize(state, b.get_glyph());
+}
+
+std::variant<Glyph, std::string>
+calculate_sample_dynamically(OptimizerState &state,
+                             const std::string &program,
+                             ComponentGlyphs *components) {
+    Bridge b;
+    b.set_components(components);
+    Lexer l(program);
+    Parser p(l);
+
+    bool parsed;
+    {
+        STAT_TIME(parse);
+        parsed = p.parse();
+    }
+    if(!parsed) {
+        std::string err("Parser fail: ");
+        err += p.get_error();
+        return err;
+    }
+    auto error = execute_parsed(p, b);
+    if(error) {
+        return *error;
+    }
+    optimize_program(state, b);
+    return std::move(b.get_glyph());
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fonttoy.hpp>
+#include <parser.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+
+class SvgExporter;
+class PhaseCache;
+
+enum class OptPhase : char { uninit, skeleton, left, right, finished };
+
+// When to end an optimization phase. Unset values keep the defaults of
+// liblbfgs. The evaluation and time limits are checked once per
+// iteration, so a line search in progress can go slightly over them.
+struct StoppingPolicy {
+    std::optional<int> window;         // Iterations to compare the objective over,
+    std::optional<double> delta;       // and the relative improvement to require.
+    std::optional<double> epsilon;     // Gradient norm tolerance relative to |x|.
+    std::optional<int> max_evaluations;
+    std::optional<double> phase_time;  // Wall clock seconds.
+
+    // Values set in other take precedence.
+    void override_with(const StoppingPolicy &other);
+};
+
+struct IterationRecord {
+    int stroke;
+    OptPhase phase;
+    int iteration;
+    int evaluations; // Since the start of the phase.
+    int line_search;
+    double objective;
+    double gradient_norm;
+    double x_norm;
+    double step;
+    double seconds; // Since the start of the phase.
+};
+
+// One level of a coarse-to-fine skeleton solve.
+struct SamplingLevelRecord {
+    int stroke;
+    int stride;
+    int iterations;
+    int evaluations;
+    double seconds;
+    double objective; // At the density of the level.
+    bool bound_tight; // Equal to the full objective, later levels skipped.
+};
+
+// Lets another thread stop an optimization in progress.
+class CancellationToken final {
+public:
+    void cancel() { cancelled = true; }
+    bool is_cancelled() const { return cancelled; }
+
+private:
+    std::atomic<bool> cancelled{false};
+};
+
+struct ReusedPhase {
+    int stroke;
+    OptPhase phase;
+};
+
+struct StrokeStart {
+    std::vector<double> skeleton;
+    std::vector<double> left;
+    std::vector<double> right;
+};
+
+struct OptimizerState {
+    Shape *s = nullptr;
+    OptPhase phase = OptPhase::uninit;
+    std::vector<std::string> frames;
+    bool use_offset_guess = true;
+    bool direct_envelope = false; // Use the fitted envelope without iterating.
+    bool use_symmetry = true; // Solve only one half of symmetric strokes.
+    bool start_only = false; // Take starts of the right size as they are, without iterating.
+    int num_threads = 0; // For independent strokes, zero means one per core.
+    bool verbose = true; // Progress printouts.
+    bool keep_frames = true; // An SVG of every evaluation and iteration.
+    // Starting values for the variables of each stroke, such as an earlier
+    // solution. Used when the sizes match; a side start is only taken if
+    // it is closer to the envelope than the offset guess.
+    std::vector<StrokeStart> starts;
+    const StrokeStart *start = nullptr; // Of the stroke being solved.
+    // Per phase counters, reset when a phase starts.
+    int evaluations = 0;
+    int iterations = 0;
+    std::chrono::steady_clock::time_point phase_start;
+    const char *stopped_by = nullptr; // The policy that ended the phase, if any.
+    StoppingPolicy stopping;
+    bool record_telemetry = false;
+    int stroke_index = 0; // For the telemetry.
+    std::vector<IterationRecord> telemetry;
+    // When cancelled or about to run past the deadline, the phase in
+    // progress stops at its current iterate and the remaining sides are
+    // taken straight from the pen envelope. The result is then partial.
+    const CancellationToken *cancel = nullptr;
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    bool partial = false;
+    double slowest_iteration = 0; // Seconds, in the current phase.
+    std::chrono::steady_clock::time_point last_iteration;
+    // Phases whose inputs are unchanged take their result from the cache
+    // instead of being solved. The starting values are not part of the
+    // inputs. Results of phases stopped by time are not stored.
+    PhaseCache *phase_cache = nullptr;
+    std::vector<ReusedPhase> reused_phases;
+    // For comparing starting points: skeletons whose objective is still
+    // above the bound of their stroke after abandon_after iterations are
+    // given up on, and the sides are not solved with skeleton_only.
+    std::vector<double> skeleton_bounds; // Per stroke, none if empty.
+    double skeleton_bound = HUGE_VAL;    // Of the stroke being solved.
+    int abandon_after = 10;
+    bool abandoned = false;
+    bool skeleton_only = false;
+    // Coarse-to-fine schedule of sample strides for the skeleton, such as
+    // {8, 1}. Every level starts from the result of the previous one, and
+    // ends the schedule if its objective is exact at its minimum. Empty
+    // solves with all samples only.
+    std::vector<int> sample_strides;
+    std::vector<SamplingLevelRecord> sampling_levels;
+
+    double calculate_value_for(const std::vector<double> &x) const;
+    // A new state with the same settings, for solving other glyphs with.
+    OptimizerState settings() const;
+};
+
+// The individual phases of optimize. state.phase must be set to the
+// phase in question.
+void optimize_skeleton(Shape *shape, OptimizerState &state);
+void optimize_side(Shape *shape, OptimizerState &state);
+// Optimizes one stroke: the skeleton first, then both sides.
+void optimize(OptimizerState &state, Shape *shape);
+// Optimizes all strokes of a glyph, independent groups in parallel.
+void optimize(OptimizerState &state, Glyph &glyph);
+
+void build_svg(Shape &s, SvgExporter &svg, OptPhase phase);
+std::string build_svg(Shape &s, OptPhase phase);
+std::string build_svg(Glyph &g, OptPhase phase);
+void write_svg(Shape &s, const char *fname, OptPhase phase);
+
+// The glyphs of a batch that programs can take solved strokes from with
+// Component. Programs see the index of each as the variable glyph_<name>.
+struct ComponentGlyphs {
+    std::vector<std::string> names;
+    std::vector<const Glyph *> solved; // Null until the glyph is solved.
+    // Set when a program needed a glyph that was not solved yet, so that
+    // the program can be run again afterwards.
+    int missing = -1;
+};
+
+// Values for top-level constants of a program, by variable name.
+using ProgramConstants = std::vector<std::pair<std::string, double>>;
+
+// Implements the drawing functions of fdef programs.
+class Bridge : public ExternalFuncall {
+public:
+    funcall_result funcall(const std::string &funname, const std::vector<double> &args) override;
+
+    // Without these, programs can not use Component.
+    void set_components(ComponentGlyphs *c) { components = c; }
+    ComponentGlyphs *get_components() const { return components; }
+
+    // Replace the values the program assigns to these variables.
+    void set_constants(ProgramConstants c) { constants = std::move(c); }
+    const ProgramConstants &get_constants() const { return constants; }
+
+    bool has_shape() { return !glyph.strokes.empty(); }
+
+    Glyph &get_glyph() { return glyph; }
+
+    // Set with the Stop* functions of the program.
+    const StoppingPolicy &get_stopping() const { return stopping; }
+
+private:
+    // Why pens and constraints can not be set on the current stroke, if
+    // they can not. Components are solved already.
+    const char *current_error() const;
+    // Constraints go to the most recently defined stroke.
+    Shape &current() {
+        assert(!glyph.strokes.empty());
+        return glyph.strokes.back();
+    }
+
+    Glyph glyph;
+    StoppingPolicy stopping;
+    ComponentGlyphs *components = nullptr;
+    ProgramConstants constants;
+};
+
+const char *phase_name(OptPhase phase);
+
+// Runs a parsed program, leaving the glyph it defines in b. Returns an
+// error message on failure. The variables named in values, if given,
+// get the values they had at the end of the program.
+std::optional<std::string>
+execute_parsed(const Parser &p, Bridge &b, ProgramConstants *values = nullptr);
+// Optimizes the glyph of a program run with execute_parsed.
+void optimize_program(OptimizerState &state, Bridge &b);
+
+// Runs the program and optimizes the glyph it defines.
+std::variant<Glyph, std::string>
+calculate_sample_dynamically(OptimizerState &state,
+                             const std::string &program,
+                             ComponentGlyphs *components = nullptr);
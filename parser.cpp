@@ -20,6 +20,9 @@
 #endif
 
 #include <parser.hpp>
+#include <stats.hpp>
+#include <trace.hpp>
+#include <algorithm>
 #include <regex>
 #include <cmath>
 
@@ -137,8 +140,10 @@ const char *node_name(const NodeType t) {
 }
 
 bool Parser::parse() {
+    TraceSpan span("Parser::parse");
     assert(nodes.size() == 0);
     assert(!is_error());
+    STAT_COUNT(tokens);
     t = l.next();
     do {
         if(accept(TokenType::eof)) {
@@ -332,6 +337,7 @@ bool Parser::e9_token() {
 
 bool Parser::accept(const TokenType type) {
     if(t.type == type) {
+        STAT_COUNT(tokens);
         t = l.next();
         return true;
     }
@@ -367,6 +373,7 @@ Interpreter::Interpreter(const Parser &p, ExternalFuncall *fp)
 }
 
 bool Interpreter::execute_program() {
+    TraceSpan span("Interpreter::execute_program");
     for(const auto statement : statements) {
         const auto &n = nodes[statement];
         if(n.type == NodeType::assignment) {
@@ -382,6 +389,17 @@ bool Interpreter::execute_program() {
     return true;
 }
 
+std::vector<std::string> Interpreter::unused_overrides() const {
+    std::vector<std::string> unused;
+    for(const auto &[name, assigned] : overrides) {
+        if(!assigned) {
+            unused.push_back(name);
+        }
+    }
+    std::sort(unused.begin(), unused.end());
+    return unused;
+}
+
 bool Interpreter::assignment(const Node &n) {
     assert(n.type == NodeType::assignment);
     const std::string &varname = std::get<std::string>(nodes[n.left.value()].value);
@@ -112,6 +112,12 @@ public:
     const std::vector<Node> &get_nodes() const { return nodes; }
     const std::vector<int> &get_statements() const { return statements; }
 
+    // Changes the value of a number literal without parsing again.
+    void set_number(int node_index, double value) {
+        assert(nodes[node_index].type == NodeType::number);
+        nodes[node_index].value = value;
+    }
+
 private:
     bool is_error() const { return !error_message.empty(); }
 
@@ -186,9 +192,28 @@ public:
 
     const std::string &get_error() const { return error_message; }
 
+    // Gives a variable a value before execution, for running a program
+    // one piece at a time.
+    void define_variable(const std::string &name, double value) { variables[name] = value; }
+
+    // Gives a variable a value that assignments in the program do not
+    // change, for running a program with other values of its constants.
+    void override_variable(const std::string &name, double value) {
+        variables[name] = value;
+        overrides[name] = false;
+    }
+
+    // Overridden variables that the program never assigned to.
+    std::vector<std::string> unused_overrides() const;
+
 private:
     bool set_variable(const std::string &name, double value) {
         // FIXME, check that we don't override global constants.
+        auto o = overrides.find(name);
+        if(o != overrides.end()) {
+            o->second = true;
+            return true;
+        }
         variables[name] = value;
         return true;
     }
@@ -227,5 +252,6 @@ private:
     const std::vector<int> &statements;
     std::string error_message;
     std::unordered_map<std::string, double> variables;
+    std::unordered_map<std::string, bool> overrides; // Whether they were assigned.
     ExternalFuncall *fp;
 };
@@ -0,0 +1,76 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pen.hpp>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+Pen::Pen(double x_radius, double y_radius, double angle)
+    : x_radius(x_radius), y_radius(y_radius), angle(angle), widths{1.0} {
+    assert(x_radius > 0);
+    assert(y_radius > 0);
+}
+
+void Pen::set_widths(std::vector<double> scales) {
+    assert(!scales.empty());
+    widths = std::move(scales);
+}
+
+double Pen::width_at(double t) const {
+    if(widths.size() == 1) {
+        return widths[0];
+    }
+    const double pos = std::clamp(t, 0.0, 1.0) * (widths.size() - 1);
+    const size_t i = std::min<size_t>(pos, widths.size() - 2);
+    const double frac = pos - i;
+    return widths[i] * (1.0 - frac) + widths[i + 1] * frac;
+}
+
+void Pen::append_parameters_to(std::vector<double> &parameters) const {
+    parameters.push_back(x_radius);
+    parameters.push_back(y_radius);
+    parameters.push_back(angle);
+    parameters.insert(parameters.end(), widths.begin(), widths.end());
+}
+
+Vector Pen::left_offset(const Vector &direction, double t) const {
+    const Vector d = direction.normalized();
+    if(d.is_numerically_zero()) {
+        return Vector(0.0, 0.0);
+    }
+    // The nib is M = R(angle) * diag(x_radius, y_radius) applied to the
+    // unit circle. Its support point in direction n is
+    // M M^T n / |M^T n|, with n the left normal of the travel direction.
+    const double c = cos(angle);
+    const double s = sin(angle);
+    const double nx = -d.y();
+    const double ny = d.x();
+    // M^T n
+    const double mx = x_radius * (c * nx + s * ny);
+    const double my = y_radius * (-s * nx + c * ny);
+    const double len = sqrt(mx * mx + my * my);
+    // M (M^T n) / |M^T n|
+    const double ux = x_radius * mx / len;
+    const double uy = y_radius * my / len;
+    const double w = width_at(t);
+    return Vector(w * (c * ux - s * uy), w * (s * ux + c * uy));
+}
+
+Vector Pen::right_offset(const Vector &direction, double t) const {
+    return left_offset(direction * -1.0, t);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <maths.hpp>
+#include <vector>
+
+// A pen nib that is dragged along the skeleton, in the spirit of
+// METAFONT's "pencircle xscaled a yscaled b rotated theta". The nib is
+// an ellipse that can additionally be scaled along the stroke.
+
+class Pen final {
+public:
+    Pen() : Pen(0.05, 0.05, 0.0) {}
+    Pen(double x_radius, double y_radius, double angle);
+
+    // Nib scale factors spread evenly over the stroke, interpolated
+    // linearly in between. A single value scales the whole stroke.
+    void set_widths(std::vector<double> scales);
+
+    double width_at(double t) const;
+
+    // Where the stroke envelope touches the nib, relative to its centre,
+    // when moving in the given direction. t runs from 0 to 1 over the
+    // whole stroke. The right side is the left side of the reverse
+    // direction.
+    Vector left_offset(const Vector &direction, double t) const;
+    Vector right_offset(const Vector &direction, double t) const;
+
+    void append_parameters_to(std::vector<double> &parameters) const;
+
+private:
+    double x_radius, y_radius, angle;
+    std::vector<double> widths;
+};
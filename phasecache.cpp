@@ -0,0 +1,137 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <phasecache.hpp>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+namespace {
+
+// Change whenever the optimizer starts producing different results, so
+// that files written by older versions are ignored.
+const char cache_format[] = "fonttoy phase cache 1";
+
+} // namespace
+
+PhaseCache::PhaseCache(size_t capacity, std::string directory)
+    : entries(capacity), directory(std::move(directory)) {}
+
+std::optional<std::vector<double>> PhaseCache::get(const std::string &key) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto cached = entries.get(key);
+        if(cached || directory.empty()) {
+            return cached;
+        }
+    }
+    auto loaded = load(key);
+    if(loaded) {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.put(key, *loaded);
+    }
+    return loaded;
+}
+
+void PhaseCache::put(const std::string &key, const std::vector<double> &variables) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.put(key, variables);
+    }
+    if(!directory.empty()) {
+        save(key, variables);
+    }
+}
+
+std::string PhaseCache::file_name(const std::string &key) const {
+    return directory + "/" + key + ".phase";
+}
+
+std::optional<std::vector<double>> PhaseCache::load(const std::string &key) const {
+    FILE *f = fopen(file_name(key).c_str(), "r");
+    if(!f) {
+        return std::optional<std::vector<double>>();
+    }
+    char header[64];
+    int count = -1;
+    bool ok = fgets(header, sizeof(header), f) &&
+              strncmp(header, cache_format, strlen(cache_format)) == 0 &&
+              fscanf(f, "%d", &count) == 1 && count >= 0;
+    std::vector<double> variables(ok ? count : 0);
+    for(int i = 0; ok && i < count; ++i) {
+        ok = fscanf(f, "%lf", &variables[i]) == 1;
+    }
+    fclose(f);
+    if(!ok) {
+        return std::optional<std::vector<double>>();
+    }
+    return variables;
+}
+
+void PhaseCache::save(const std::string &key, const std::vector<double> &variables) const {
+    const auto final_name = file_name(key);
+    // Unique among the threads and processes writing the same key.
+    const auto temp_name = final_name + "." + std::to_string(std::random_device()()) + ".tmp";
+    FILE *f = fopen(temp_name.c_str(), "w");
+    if(!f) {
+        return;
+    }
+    fprintf(f, "%s\n%d\n", cache_format, (int)variables.size());
+    for(const auto v : variables) {
+        // Enough digits to read back the same double.
+        fprintf(f, "%.17g\n", v);
+    }
+    if(fclose(f) != 0 || rename(temp_name.c_str(), final_name.c_str()) != 0) {
+        remove(temp_name.c_str());
+    }
+}
+
+void PhaseKey::add_bytes(const void *data, size_t size) {
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    for(size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+void PhaseKey::add(const std::string &s) {
+    const uint64_t size = s.size();
+    add_bytes(&size, sizeof(size));
+    add_bytes(s.data(), s.size());
+}
+
+void PhaseKey::add(double d) {
+    // Both zeros give the same result.
+    if(d == 0.0) {
+        d = 0.0;
+    }
+    add_bytes(&d, sizeof(d));
+}
+
+void PhaseKey::add(const std::vector<double> &values) {
+    const uint64_t size = values.size();
+    add_bytes(&size, sizeof(size));
+    for(const auto v : values) {
+        add(v);
+    }
+}
+
+std::string PhaseKey::str() const {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)hash);
+    return buf;
+}
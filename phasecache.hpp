@@ -0,0 +1,68 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <lrucache.hpp>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Results of optimization phases keyed by a hash of everything the phase
+// depends on, so that a phase whose inputs did not change is not solved
+// again. Thread safe.
+//
+// With a directory the results are also stored there, one file per key,
+// and survive the process. Files are written to a temporary name and
+// renamed, so several processes can share a directory.
+class PhaseCache final {
+public:
+    explicit PhaseCache(size_t capacity = 1024, std::string directory = std::string());
+
+    std::optional<std::vector<double>> get(const std::string &key);
+    void put(const std::string &key, const std::vector<double> &variables);
+
+private:
+    std::string file_name(const std::string &key) const;
+    std::optional<std::vector<double>> load(const std::string &key) const;
+    void save(const std::string &key, const std::vector<double> &variables) const;
+
+    std::mutex mutex;
+    LruCache<std::vector<double>> entries;
+    std::string directory;
+};
+
+// Builds a cache key out of a description and the exact bit patterns of
+// the values.
+class PhaseKey final {
+public:
+    explicit PhaseKey(const std::string &description) { add(description); }
+
+    void add(const std::string &s);
+    void add(double d);
+    void add(const std::vector<double> &values);
+
+    // 16 hex digits.
+    std::string str() const;
+
+private:
+    void add_bytes(const void *data, size_t size);
+
+    uint64_t hash = 14695981039346656037ull; // FNV-1a offset basis.
+};
@@ -0,0 +1,202 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <rasterizer.hpp>
+#include <stats.hpp>
+#include <cmath>
+#include <cassert>
+#include <cstdio>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Maximum distance, in pixels, between a flattened segment and the curve.
+const double flatness_tolerance = 0.2;
+const int max_subdivision_depth = 16;
+
+Point midpoint(const Point &a, const Point &b) {
+    return Point((a.x() + b.x()) / 2.0, (a.y() + b.y()) / 2.0);
+}
+
+} // namespace
+
+Rasterizer::Rasterizer(int size) : size(size) {
+    assert(size > 0);
+    // Edges clamped to the right border spill into the first cell of the
+    // following row, so the last row needs one extra cell. Pad to a
+    // multiple of four for the vectorized accumulation.
+    const size_t cells = (size_t)size * size + 4;
+    accumulation.resize((cells + 3) & ~(size_t)3, 0.0f);
+}
+
+Point Rasterizer::to_pixel(const Point &p) const {
+    return Point(p.x() * size, (1.0 - p.y()) * size);
+}
+
+void Rasterizer::draw_line(const Point &p0, const Point &p1) {
+    draw_pixel_line(to_pixel(p0), to_pixel(p1));
+}
+
+void Rasterizer::draw_bezier(const Bezier &b) {
+    flatten(to_pixel(b.p1()), to_pixel(b.c1()), to_pixel(b.c2()), to_pixel(b.p2()), 0);
+}
+
+void Rasterizer::draw_outline(const std::vector<Bezier> &outline) {
+    for(const auto &b : outline) {
+        draw_bezier(b);
+    }
+}
+
+void Rasterizer::draw_shape(const std::vector<Bezier> &left_beziers,
+                            const std::vector<Bezier> &right_beziers) {
+    draw_outline(closed_outline(left_beziers, right_beziers));
+}
+
+void Rasterizer::flatten(
+    const Point &p1, const Point &c1, const Point &c2, const Point &p2, int depth) {
+    // The deviation of a cubic from its chord is bounded by 3/4 of the
+    // largest second difference of its control polygon.
+    const double ddx1 = p1.x() - 2.0 * c1.x() + c2.x();
+    const double ddy1 = p1.y() - 2.0 * c1.y() + c2.y();
+    const double ddx2 = c1.x() - 2.0 * c2.x() + p2.x();
+    const double ddy2 = c1.y() - 2.0 * c2.y() + p2.y();
+    const double dd = std::max(ddx1 * ddx1 + ddy1 * ddy1, ddx2 * ddx2 + ddy2 * ddy2);
+    if(depth >= max_subdivision_depth ||
+       dd * (9.0 / 16.0) <= flatness_tolerance * flatness_tolerance) {
+        draw_pixel_line(p1, p2);
+        return;
+    }
+    // De Casteljau split at t = 0.5.
+    const Point p12 = midpoint(p1, c1);
+    const Point p23 = midpoint(c1, c2);
+    const Point p34 = midpoint(c2, p2);
+    const Point p123 = midpoint(p12, p23);
+    const Point p234 = midpoint(p23, p34);
+    const Point mid = midpoint(p123, p234);
+    flatten(p1, p12, p123, mid, depth + 1);
+    flatten(mid, p234, p34, p2, depth + 1);
+}
+
+void Rasterizer::draw_pixel_line(const Point &start, const Point &end) {
+    if(fabs(start.y() - end.y()) <= 1e-9) {
+        return;
+    }
+    const bool downwards = start.y() < end.y();
+    const float dir = downwards ? 1.0f : -1.0f;
+    const Point &p0 = downwards ? start : end;
+    const Point &p1 = downwards ? end : start;
+    const float fsize = size;
+    const float dxdy = (p1.x() - p0.x()) / (p1.y() - p0.y());
+    float x = p0.x();
+    if(p0.y() < 0.0) {
+        x -= p0.y() * dxdy;
+    }
+    const int y_start = std::max(0, (int)p0.y());
+    const int y_end = std::min(size, (int)ceil(p1.y()));
+    for(int y = y_start; y < y_end; ++y) {
+        float *row = &accumulation[(size_t)y * size];
+        const float dy = std::min<float>(y + 1, p1.y()) - std::max<float>(y, p0.y());
+        const float xnext = x + dxdy * dy;
+        const float d = dy * dir;
+        // Everything left of the image accumulates into the first column
+        // and everything right of it into the cell past the last one.
+        const float x0 = std::clamp(std::min(x, xnext), 0.0f, fsize);
+        const float x1 = std::clamp(std::max(x, xnext), 0.0f, fsize);
+        const float x0floor = floorf(x0);
+        const int x0i = (int)x0floor;
+        const float x1ceil = ceilf(x1);
+        const int x1i = (int)x1ceil;
+        if(x1i <= x0i + 1) {
+            const float xmf = 0.5f * (x0 + x1) - x0floor;
+            row[x0i] += d - d * xmf;
+            row[x0i + 1] += d * xmf;
+        } else {
+            const float s = 1.0f / (x1 - x0);
+            const float x0f = x0 - x0floor;
+            const float a0 = 0.5f * s * (1.0f - x0f) * (1.0f - x0f);
+            const float x1f = x1 - x1ceil + 1.0f;
+            const float am = 0.5f * s * x1f * x1f;
+            row[x0i] += d * a0;
+            if(x1i == x0i + 2) {
+                row[x0i + 1] += d * (1.0f - a0 - am);
+            } else {
+                const float a1 = s * (1.5f - x0f);
+                row[x0i + 1] += d * (a1 - a0);
+                for(int xi = x0i + 2; xi < x1i - 1; ++xi) {
+                    row[xi] += d * s;
+                }
+                const float a2 = a1 + (x1i - x0i - 3) * s;
+                row[x1i - 1] += d * (1.0f - a2 - am);
+            }
+            row[x1i] += d * am;
+        }
+        x = xnext;
+    }
+}
+
+std::vector<uint8_t> Rasterizer::get_coverage() const {
+    const size_t num_pixels = (size_t)size * size;
+    std::vector<uint8_t> pixels(accumulation.size());
+    size_t i = 0;
+#if defined(__SSE2__)
+    // Four lane prefix sum, carrying the running total in all lanes.
+    __m128 offset = _mm_setzero_ps();
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    for(; i + 4 <= accumulation.size(); i += 4) {
+        __m128 x = _mm_loadu_ps(&accumulation[i]);
+        x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+        x = _mm_add_ps(x, _mm_shuffle_ps(_mm_setzero_ps(), x, 0x40));
+        x = _mm_add_ps(x, offset);
+        __m128 y = _mm_andnot_ps(sign_mask, x);
+        y = _mm_mul_ps(_mm_min_ps(y, one), scale);
+        __m128i z = _mm_cvtps_epi32(y);
+        z = _mm_packs_epi32(z, z);
+        z = _mm_packus_epi16(z, z);
+        const int32_t packed = _mm_cvtsi128_si32(z);
+        std::copy((const uint8_t *)&packed, (const uint8_t *)&packed + 4, &pixels[i]);
+        offset = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    float acc = _mm_cvtss_f32(offset);
+#else
+    float acc = 0.0f;
+#endif
+    for(; i < accumulation.size(); ++i) {
+        acc += accumulation[i];
+        pixels[i] = (uint8_t)lrintf(std::min(fabsf(acc), 1.0f) * 255.0f);
+    }
+    pixels.resize(num_pixels);
+    return pixels;
+}
+
+bool write_pgm(const char *fname, const std::vector<uint8_t> &pixels, int width, int height) {
+    assert(pixels.size() == (size_t)width * height);
+    FILE *f = fopen(fname, "wb");
+    if(!f) {
+        return false;
+    }
+    fprintf(f, "P5\n%d %d\n255\n", width, height);
+    const bool ok = fwrite(pixels.data(), 1, pixels.size(), f) == pixels.size();
+    STAT_COUNT_N(bytes_written, ftell(f));
+    fclose(f);
+    return ok;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fonttoy.hpp>
+#include <vector>
+#include <cstdint>
+
+// Antialiased coverage rasterizer for closed outlines. Lines deposit
+// signed area into an accumulation buffer and a single prefix sum pass
+// turns that into per pixel coverage (nonzero winding, clamped to one).
+//
+// The em square (0, 0)-(1, 1) is mapped onto a size x size image with
+// y pointing down. Anything outside of it is clipped.
+
+class Rasterizer final {
+public:
+    explicit Rasterizer(int size);
+
+    void draw_line(const Point &p0, const Point &p1);
+    void draw_bezier(const Bezier &b);
+
+    void draw_outline(const std::vector<Bezier> &outline);
+
+    // The closed outline that SvgExporter::draw_shape fills.
+    void draw_shape(const std::vector<Bezier> &left_beziers,
+                    const std::vector<Bezier> &right_beziers);
+
+    std::vector<uint8_t> get_coverage() const;
+
+    int get_size() const { return size; }
+
+private:
+    Point to_pixel(const Point &p) const;
+    void draw_pixel_line(const Point &p0, const Point &p1);
+    void flatten(const Point &p1, const Point &c1, const Point &c2, const Point &p2, int depth);
+
+    int size;
+    std::vector<float> accumulation;
+};
+
+bool write_pgm(const char *fname, const std::vector<uint8_t> &pixels, int width, int height);
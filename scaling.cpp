@@ -0,0 +1,356 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <generator.hpp>
+#include <optimizer.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Runs generated programs of increasing size through the whole pipeline
+// and reports how each phase grows. Every size runs in a child process
+// of its own so that the peak memory use is that of the size alone. The
+// growth exponent is the slope of a least squares line through the
+// log-log points: 1 is linear, 2 is quadratic.
+
+namespace {
+
+enum ScalingPhase : int { generate, parse, interpret, freeze, skeleton, left, right, num_phases };
+
+const char *phase_names[num_phases] = {
+    "generate", "parse", "interpret", "freeze", "skeleton", "left", "right"};
+
+struct ScalingCase {
+    int num_beziers;
+    bool ok;
+    double seconds[num_phases];
+    int evaluations[num_phases]; // Only the optimization phases have these.
+    int iterations[num_phases];
+    long long peak_rss_kb; // -1 if not known.
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool run_program(const Parser &p, Bridge &b) {
+    Interpreter i(p, &b);
+    return i.execute_program() && b.has_shape();
+}
+
+void run_case(ScalingCase &c, const GeneratorSettings &settings, bool optimize_phases) {
+    c.ok = false;
+    auto start = std::chrono::steady_clock::now();
+    const auto program = generate_fdef(settings);
+    c.seconds[generate] = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    Lexer l(program);
+    Parser p(l);
+    if(!p.parse()) {
+        fprintf(stderr, "Parser fail: %s\n", p.get_error().c_str());
+        return;
+    }
+    c.seconds[parse] = seconds_since(start);
+
+    // Interpretation includes setting up all the constraints.
+    Bridge b;
+    start = std::chrono::steady_clock::now();
+    if(!run_program(p, b)) {
+        fprintf(stderr, "Interpreter fail.\n");
+        return;
+    }
+    c.seconds[interpret] = seconds_since(start);
+
+    // The skeleton phase freezes its stroke, so freezing is measured on a
+    // second copy.
+    {
+        Bridge copy;
+        if(!run_program(p, copy)) {
+            return;
+        }
+        start = std::chrono::steady_clock::now();
+        copy.get_glyph().strokes.front().skeleton.freeze();
+        c.seconds[freeze] = seconds_since(start);
+    }
+
+    if(optimize_phases) {
+        Shape &shape = b.get_glyph().strokes.front();
+        OptimizerState state;
+        state.verbose = false;
+        state.keep_frames = false; // Frame output would dominate the larger sizes.
+        for(const auto phase : {skeleton, left, right}) {
+            state.phase = phase == skeleton ? OptPhase::skeleton
+                                            : phase == left ? OptPhase::left : OptPhase::right;
+            start = std::chrono::steady_clock::now();
+            if(phase == skeleton) {
+                optimize_skeleton(&shape, state);
+            } else {
+                optimize_side(&shape, state);
+            }
+            c.seconds[phase] = seconds_since(start);
+            c.evaluations[phase] = state.evaluations;
+            c.iterations[phase] = state.iterations;
+        }
+    }
+    c.ok = true;
+}
+
+#if defined(_WIN32)
+
+void measure(ScalingCase &c, const GeneratorSettings &settings, bool optimize_phases) {
+    run_case(c, settings, optimize_phases);
+}
+
+#else
+
+void measure(ScalingCase &c, const GeneratorSettings &settings, bool optimize_phases) {
+    int fds[2];
+    if(pipe(fds) != 0) {
+        return;
+    }
+    const pid_t pid = fork();
+    if(pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+    if(pid == 0) {
+        close(fds[0]);
+        run_case(c, settings, optimize_phases);
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        c.peak_rss_kb = usage.ru_maxrss;
+#if defined(__APPLE__)
+        c.peak_rss_kb /= 1024; // Bytes rather than kilobytes.
+#endif
+        const bool written = write(fds[1], &c, sizeof(c)) == (ssize_t)sizeof(c);
+        close(fds[1]);
+        _exit(written ? 0 : 1);
+    }
+    close(fds[1]);
+    ScalingCase result;
+    const bool got_result = read(fds[0], &result, sizeof(result)) == (ssize_t)sizeof(result);
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if(got_result) {
+        c = result;
+    }
+}
+
+#endif
+
+// Slope of log(y) against log(x), NaN if there are not enough points.
+double growth_exponent(const std::vector<double> &x, const std::vector<double> &y) {
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int n = 0;
+    for(size_t i = 0; i < x.size(); ++i) {
+        if(!(y[i] > 0)) {
+            continue;
+        }
+        const double lx = log(x[i]);
+        const double ly = log(y[i]);
+        sx += lx;
+        sy += ly;
+        sxx += lx * lx;
+        sxy += lx * ly;
+        ++n;
+    }
+    const double denominator = n * sxx - sx * sx;
+    if(n < 2 || fabs(denominator) < 1e-12) {
+        return NAN;
+    }
+    return (n * sxy - sx * sy) / denominator;
+}
+
+std::string json_number(double d) {
+    if(!std::isfinite(d)) {
+        return "null";
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.6g", d);
+    return buf;
+}
+
+std::string to_json(const std::vector<ScalingCase> &cases, int first_phase, int end_phase) {
+    std::string json("{\n  \"cases\": [\n");
+    for(size_t i = 0; i < cases.size(); ++i) {
+        const auto &c = cases[i];
+        json += "    {\"num_beziers\": " + std::to_string(c.num_beziers);
+        json += ", \"peak_rss_kb\": " + std::to_string(c.peak_rss_kb);
+        for(int p = first_phase; p < end_phase; ++p) {
+            json += std::string(", \"") + phase_names[p] + "\": {\"seconds\": ";
+            json += json_number(c.seconds[p]);
+            if(p >= skeleton) {
+                json += ", \"evaluations\": " + std::to_string(c.evaluations[p]);
+                json += ", \"iterations\": " + std::to_string(c.iterations[p]);
+            }
+            json += "}";
+        }
+        json += i + 1 < cases.size() ? "},\n" : "}\n";
+    }
+    json += "  ],\n  \"growth_exponents\": {";
+    std::vector<double> sizes;
+    for(const auto &c : cases) {
+        sizes.push_back(c.num_beziers);
+    }
+    for(int p = first_phase; p < end_phase; ++p) {
+        std::vector<double> times;
+        for(const auto &c : cases) {
+            times.push_back(c.seconds[p]);
+        }
+        json += p > first_phase ? ", \"" : "\"";
+        json += std::string(phase_names[p]) + "\": " + json_number(growth_exponent(sizes, times));
+    }
+    std::vector<double> memory;
+    for(const auto &c : cases) {
+        memory.push_back(c.peak_rss_kb);
+    }
+    json += ", \"peak_rss_kb\": " + json_number(growth_exponent(sizes, memory)) + "}\n}\n";
+    return json;
+}
+
+void print_table(const std::vector<ScalingCase> &cases, int end_phase) {
+    printf("%8s", "beziers");
+    for(int p = 0; p < end_phase; ++p) {
+        printf(" %10s", phase_names[p]);
+    }
+    if(end_phase > skeleton) {
+        printf(" %8s", "evals");
+    }
+    printf(" %10s\n", "peak kB");
+    for(const auto &c : cases) {
+        printf("%8d", c.num_beziers);
+        for(int p = 0; p < end_phase; ++p) {
+            printf(" %9.2fm", c.seconds[p] * 1000);
+        }
+        if(end_phase > skeleton) {
+            printf(" %8d", c.evaluations[skeleton] + c.evaluations[left] + c.evaluations[right]);
+        }
+        printf(" %10lld\n", c.peak_rss_kb);
+    }
+    std::vector<double> sizes;
+    for(const auto &c : cases) {
+        sizes.push_back(c.num_beziers);
+    }
+    // Constant overheads hide the growth at small sizes, so the exponent
+    // between the two largest sizes is shown as well.
+    const size_t last = sizes.size() >= 2 ? sizes.size() - 2 : 0;
+    for(const size_t first : {size_t(0), last}) {
+        printf("%8s", first == 0 ? "fit" : "last");
+        for(int p = 0; p < end_phase; ++p) {
+            std::vector<double> x, times;
+            for(size_t i = first; i < cases.size(); ++i) {
+                x.push_back(sizes[i]);
+                times.push_back(cases[i].seconds[p]);
+            }
+            printf(" %10.2f", growth_exponent(x, times));
+        }
+        printf("\n");
+    }
+    printf("Times are in milliseconds, the last two rows are growth exponents.\n");
+    printf("The skeleton phase includes freezing.\n");
+}
+
+std::vector<int> parse_sizes(const char *str) {
+    std::vector<int> sizes;
+    while(*str) {
+        char *end;
+        const long n = strtol(str, &end, 10);
+        if(end == str || n <= 0 || (*end != ',' && *end != '\0')) {
+            return std::vector<int>();
+        }
+        sizes.push_back((int)n);
+        str = *end ? end + 1 : end;
+    }
+    return sizes;
+}
+
+void print_usage(const char *progname) {
+    printf("%s [options]\n\n", progname);
+    printf("  --sizes=6,12,25,50,100,200  bezier counts to measure\n");
+    printf("  --setup-only                skip the optimization phases\n");
+    printf("  --seed=1                    generator seed\n");
+    printf("  --json=out.json             also write the results as JSON\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::vector<int> sizes{6, 12, 25, 50, 100, 200};
+    bool optimize_phases = true;
+    GeneratorSettings settings;
+    const char *json_file = nullptr;
+    for(int i = 1; i < argc; ++i) {
+        if(strncmp(argv[i], "--sizes=", 8) == 0) {
+            sizes = parse_sizes(argv[i] + 8);
+        } else if(strcmp(argv[i], "--setup-only") == 0) {
+            optimize_phases = false;
+        } else if(strncmp(argv[i], "--seed=", 7) == 0) {
+            settings.seed = strtoul(argv[i] + 7, nullptr, 10);
+        } else if(strncmp(argv[i], "--json=", 7) == 0) {
+            json_file = argv[i] + 7;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if(sizes.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    std::vector<ScalingCase> cases;
+    for(const int n : sizes) {
+        fprintf(stderr, "Measuring %d beziers.\n", n);
+        ScalingCase c{};
+        c.num_beziers = n;
+        c.peak_rss_kb = -1;
+        settings.num_beziers = n;
+        measure(c, settings, optimize_phases);
+        if(!c.ok) {
+            printf("Measurement of %d beziers failed.\n", n);
+            return 1;
+        }
+        cases.push_back(c);
+    }
+    const int end_phase = optimize_phases ? num_phases : skeleton;
+    print_table(cases, end_phase);
+    if(json_file) {
+        const auto json = to_json(cases, 0, end_phase);
+        FILE *f = fopen(json_file, "w");
+        if(!f || fwrite(json.data(), 1, json.size(), f) != json.size()) {
+            printf("Could not write %s.\n", json_file);
+            if(f) {
+                fclose(f);
+            }
+            return 1;
+        }
+        fclose(f);
+    }
+    return 0;
+}
@@ -0,0 +1,392 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sdf.hpp>
+#include <rasterizer.hpp>
+#include <stats.hpp>
+#include <cmath>
+#include <cassert>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <limits>
+#include <optional>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Each segment is approximated with this many chords for the coarse
+// search. The closest chord then seeds a Newton refinement on the cubic.
+const int chords_per_segment = 16;
+const int newton_iterations = 4;
+const int tile_rows = 16;
+
+// Chords stored as struct of arrays so the coarse search runs four
+// chords per instruction. Padded with far away dummies.
+struct ChordSet {
+    std::vector<float> ax, ay, ex, ey, inv_len2;
+    int count = 0;
+
+    void add(const Point &a, const Point &b) {
+        const double dx = b.x() - a.x();
+        const double dy = b.y() - a.y();
+        const double len2 = dx * dx + dy * dy;
+        ax.push_back(a.x());
+        ay.push_back(a.y());
+        ex.push_back(dx);
+        ey.push_back(dy);
+        inv_len2.push_back(len2 > 0.0 ? 1.0 / len2 : 0.0);
+        ++count;
+    }
+
+    void pad() {
+        while(ax.size() % 4 != 0) {
+            ax.push_back(1e6f);
+            ay.push_back(1e6f);
+            ex.push_back(0.0f);
+            ey.push_back(0.0f);
+            inv_len2.push_back(0.0f);
+        }
+    }
+};
+
+struct CoarseResult {
+    float dist2;
+    int chord;
+    int winding;
+};
+
+CoarseResult coarse_search(const ChordSet &c, float px, float py) {
+    CoarseResult r{std::numeric_limits<float>::max(), 0, 0};
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 vpx = _mm_set1_ps(px);
+    const __m128 vpy = _mm_set1_ps(py);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 best = _mm_set1_ps(std::numeric_limits<float>::max());
+    __m128i best_index = _mm_setzero_si128();
+    __m128i index = _mm_set_epi32(3, 2, 1, 0);
+    const __m128i four = _mm_set1_epi32(4);
+    __m128i winding = _mm_setzero_si128();
+    for(; i < c.ax.size(); i += 4) {
+        const __m128 ax = _mm_loadu_ps(&c.ax[i]);
+        const __m128 ay = _mm_loadu_ps(&c.ay[i]);
+        const __m128 ex = _mm_loadu_ps(&c.ex[i]);
+        const __m128 ey = _mm_loadu_ps(&c.ey[i]);
+        const __m128 dx = _mm_sub_ps(vpx, ax);
+        const __m128 dy = _mm_sub_ps(vpy, ay);
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(dx, ex), _mm_mul_ps(dy, ey)),
+                              _mm_loadu_ps(&c.inv_len2[i]));
+        t = _mm_min_ps(_mm_max_ps(t, zero), one);
+        const __m128 qx = _mm_sub_ps(dx, _mm_mul_ps(t, ex));
+        const __m128 qy = _mm_sub_ps(dy, _mm_mul_ps(t, ey));
+        const __m128 d2 = _mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy));
+        const __m128 closer = _mm_cmplt_ps(d2, best);
+        best = _mm_min_ps(d2, best);
+        best_index = _mm_or_si128(_mm_and_si128(_mm_castps_si128(closer), index),
+                                  _mm_andnot_si128(_mm_castps_si128(closer), best_index));
+        index = _mm_add_epi32(index, four);
+        // Nonzero winding: a chord crossing the horizontal ray to the
+        // right of the point counts +1 upwards and -1 downwards.
+        const __m128 by = _mm_add_ps(ay, ey);
+        const __m128 up = _mm_and_ps(_mm_cmple_ps(ay, vpy), _mm_cmpgt_ps(by, vpy));
+        const __m128 down = _mm_and_ps(_mm_cmpgt_ps(ay, vpy), _mm_cmple_ps(by, vpy));
+        // Cross product sign tells which side of the chord the point is on.
+        const __m128 cross = _mm_sub_ps(_mm_mul_ps(ex, dy), _mm_mul_ps(ey, dx));
+        const __m128 left = _mm_cmpgt_ps(cross, zero);
+        const __m128 right = _mm_cmplt_ps(cross, zero);
+        winding = _mm_sub_epi32(winding, _mm_castps_si128(_mm_and_ps(up, left)));
+        winding = _mm_add_epi32(winding, _mm_castps_si128(_mm_and_ps(down, right)));
+    }
+    alignas(16) float bests[4];
+    alignas(16) int32_t indices[4];
+    alignas(16) int32_t windings[4];
+    _mm_store_ps(bests, best);
+    _mm_store_si128((__m128i *)indices, best_index);
+    _mm_store_si128((__m128i *)windings, winding);
+    for(int lane = 0; lane < 4; ++lane) {
+        if(bests[lane] < r.dist2) {
+            r.dist2 = bests[lane];
+            r.chord = indices[lane];
+        }
+        r.winding += windings[lane];
+    }
+#endif
+    for(; i < c.ax.size(); ++i) {
+        const float dx = px - c.ax[i];
+        const float dy = py - c.ay[i];
+        const float t = std::clamp((dx * c.ex[i] + dy * c.ey[i]) * c.inv_len2[i], 0.0f, 1.0f);
+        const float qx = dx - t * c.ex[i];
+        const float qy = dy - t * c.ey[i];
+        const float d2 = qx * qx + qy * qy;
+        if(d2 < r.dist2) {
+            r.dist2 = d2;
+            r.chord = i;
+        }
+        const float by = c.ay[i] + c.ey[i];
+        const float cross = c.ex[i] * dy - c.ey[i] * dx;
+        if(c.ay[i] <= py && by > py && cross > 0) {
+            ++r.winding;
+        } else if(c.ay[i] > py && by <= py && cross < 0) {
+            --r.winding;
+        }
+    }
+    return r;
+}
+
+// Newton iteration on (B(t) - p) . B'(t) = 0 starting from the chord
+// estimate, limited to the neighbourhood of that chord. Empty if not even
+// the first step can be taken.
+std::optional<double>
+refined_distance(const Bezier &b, const Point &p, double t, double tmin, double tmax) {
+    for(int i = 0; i < newton_iterations; ++i) {
+        const Vector diff = b.evaluate(t) - p;
+        const Vector d1 = b.evaluate_d1(t);
+        const Vector d2 = b.evaluate_d2(t);
+        const double f = diff.dot(d1);
+        const double df = d1.dot(d1) + diff.dot(d2);
+        if(df <= 0.0) {
+            if(i == 0) {
+                return {};
+            }
+            break;
+        }
+        t = std::clamp(t - f / df, tmin, tmax);
+    }
+    return (b.evaluate(t) - p).length();
+}
+
+struct GlyphJob {
+    std::vector<Bezier> pixel_outline;
+    ChordSet chords;
+    const SdfAtlasEntry *entry;
+};
+
+Point to_tile(const Point &p, const SdfAtlasEntry &e, int pixels_per_em) {
+    return Point((p.x() - e.left) * pixels_per_em, (e.top - p.y()) * pixels_per_em);
+}
+
+void render_rows(const GlyphJob &job,
+                 int first_row,
+                 int last_row,
+                 double range,
+                 int atlas_width,
+                 std::vector<uint8_t> &pixels) {
+    const SdfAtlasEntry &e = *job.entry;
+    for(int row = first_row; row < last_row; ++row) {
+        uint8_t *out = &pixels[(size_t)(e.y + row) * atlas_width + e.x];
+        for(int col = 0; col < e.width; ++col) {
+            const Point p(col + 0.5, row + 0.5);
+            const auto coarse = coarse_search(job.chords, p.x(), p.y());
+            const int segment = coarse.chord / chords_per_segment;
+            const double t0 = double(coarse.chord % chords_per_segment) / chords_per_segment;
+            const double t1 = t0 + 1.0 / chords_per_segment;
+            const double tmin = std::max(0.0, t0 - 1.0 / chords_per_segment);
+            const double tmax = std::min(1.0, t1 + 1.0 / chords_per_segment);
+            const Bezier &b = job.pixel_outline[segment];
+            // The chord can pass closer to p than the curve does, so its
+            // distance is only used when Newton fails.
+            const double dist = refined_distance(b, p, (t0 + t1) / 2, tmin, tmax)
+                                    .value_or(sqrtf(coarse.dist2));
+            const double signed_dist = coarse.winding != 0 ? dist : -dist;
+            const double normalized = std::clamp(0.5 + 0.5 * signed_dist / range, 0.0, 1.0);
+            out[col] = (uint8_t)lrint(normalized * 255.0);
+        }
+    }
+}
+
+} // namespace
+
+SdfAtlas::SdfAtlas(const std::vector<SdfGlyph> &glyphs, const SdfSettings &settings)
+    : settings(settings) {
+    const double pad = settings.range / settings.pixels_per_em;
+    for(const auto &g : glyphs) {
+        assert(!g.outline.empty());
+        // The control polygon bounds the curve, so this is conservative.
+        double left = g.outline[0].p1().x(), right = left;
+        double bottom = g.outline[0].p1().y(), top = bottom;
+        for(const auto &b : g.outline) {
+            for(const Point *p : {&b.p1(), &b.c1(), &b.c2(), &b.p2()}) {
+                left = std::min(left, p->x());
+                right = std::max(right, p->x());
+                bottom = std::min(bottom, p->y());
+                top = std::max(top, p->y());
+            }
+        }
+        SdfAtlasEntry e;
+        e.name = g.name;
+        e.x = e.y = 0;
+        e.width = (int)ceil((right - left + 2 * pad) * settings.pixels_per_em);
+        e.height = (int)ceil((top - bottom + 2 * pad) * settings.pixels_per_em);
+        e.left = left - pad;
+        e.top = top + pad;
+        e.right = e.left + double(e.width) / settings.pixels_per_em;
+        e.bottom = e.top - double(e.height) / settings.pixels_per_em;
+        entries.push_back(e);
+    }
+    pack();
+    pixels.assign((size_t)width * height, 0);
+
+    std::vector<GlyphJob> jobs(glyphs.size());
+    for(size_t i = 0; i < glyphs.size(); ++i) {
+        auto &job = jobs[i];
+        job.entry = &entries[i];
+        for(const auto &b : glyphs[i].outline) {
+            const int ppem = settings.pixels_per_em;
+            Bezier pb(to_tile(b.p1(), entries[i], ppem),
+                      to_tile(b.c1(), entries[i], ppem),
+                      to_tile(b.c2(), entries[i], ppem),
+                      to_tile(b.p2(), entries[i], ppem));
+            Point prev = pb.p1();
+            for(int c = 1; c <= chords_per_segment; ++c) {
+                const Point next = pb.evaluate(double(c) / chords_per_segment);
+                job.chords.add(prev, next);
+                prev = next;
+            }
+            job.pixel_outline.push_back(pb);
+        }
+        job.chords.pad();
+    }
+
+    // Work is split into bands of rows so that a single large glyph
+    // still spreads over all threads.
+    std::vector<std::pair<int, int>> work;
+    for(size_t i = 0; i < jobs.size(); ++i) {
+        for(int row = 0; row < entries[i].height; row += tile_rows) {
+            work.emplace_back(i, row);
+        }
+    }
+    std::atomic<size_t> next_work{0};
+    auto worker = [&]() {
+        for(size_t w = next_work++; w < work.size(); w = next_work++) {
+            const auto &job = jobs[work[w].first];
+            const int first = work[w].second;
+            const int last = std::min(first + tile_rows, job.entry->height);
+            render_rows(job, first, last, settings.range, width, pixels);
+        }
+    };
+    int num_threads = settings.num_threads;
+    if(num_threads <= 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::min<int>(num_threads, work.size());
+    std::vector<std::thread> threads;
+    for(int i = 1; i < num_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for(auto &t : threads) {
+        t.join();
+    }
+}
+
+void SdfAtlas::pack() {
+    // Shelf packing, tallest tiles first.
+    std::vector<size_t> order(entries.size());
+    double area = 0;
+    int widest = 1;
+    for(size_t i = 0; i < entries.size(); ++i) {
+        order[i] = i;
+        area += entries[i].width * entries[i].height;
+        widest = std::max(widest, entries[i].width);
+    }
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return entries[a].height > entries[b].height;
+    });
+    width = 1;
+    while(width < widest || width * width < area) {
+        width *= 2;
+    }
+    int x = 0, y = 0, shelf_height = 0;
+    for(auto i : order) {
+        auto &e = entries[i];
+        if(x + e.width > width) {
+            x = 0;
+            y += shelf_height;
+            shelf_height = 0;
+        }
+        e.x = x;
+        e.y = y;
+        x += e.width;
+        shelf_height = std::max(shelf_height, e.height);
+    }
+    height = y + shelf_height;
+}
+
+std::string SdfAtlas::metrics_json() const {
+    std::string json;
+    char buf[1024];
+    snprintf(buf,
+             sizeof(buf),
+             "{\n  \"width\": %d,\n  \"height\": %d,\n  \"pixels_per_em\": %d,\n"
+             "  \"distance_range\": %f,\n  \"glyphs\": [\n",
+             width,
+             height,
+             settings.pixels_per_em,
+             settings.range);
+    json += buf;
+    for(size_t i = 0; i < entries.size(); ++i) {
+        const auto &e = entries[i];
+        // Glyph names come from file names, so no escaping is attempted.
+        snprintf(buf,
+                 sizeof(buf),
+                 "    {\"name\": \"%s\", \"x\": %d, \"y\": %d, \"width\": %d, \"height\": %d,\n"
+                 "     \"uv\": [%f, %f, %f, %f],\n"
+                 "     \"plane\": [%f, %f, %f, %f]}%s\n",
+                 e.name.c_str(),
+                 e.x,
+                 e.y,
+                 e.width,
+                 e.height,
+                 double(e.x) / width,
+                 double(e.y) / height,
+                 double(e.x + e.width) / width,
+                 double(e.y + e.height) / height,
+                 e.left,
+                 e.bottom,
+                 e.right,
+                 e.top,
+                 i + 1 < entries.size() ? "," : "");
+        json += buf;
+    }
+    json += "  ]\n}\n";
+    return json;
+}
+
+bool SdfAtlas::write(const char *basename) const {
+    std::string image_name(basename);
+    image_name += ".pgm";
+    if(!write_pgm(image_name.c_str(), pixels, width, height)) {
+        return false;
+    }
+    std::string json_name(basename);
+    json_name += ".json";
+    FILE *f = fopen(json_name.c_str(), "w");
+    if(!f) {
+        return false;
+    }
+    const auto json = metrics_json();
+    const bool ok = fwrite(json.data(), 1, json.size(), f) == json.size();
+    STAT_COUNT_N(bytes_written, ftell(f));
+    fclose(f);
+    return ok;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <maths.hpp>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Signed distance field generation straight from the outline beziers.
+// Positive distances are inside the glyph. Stored values map the
+// distance range [-range, range] pixels onto [0, 255], so 128 is the
+// outline itself.
+
+struct SdfGlyph {
+    std::string name;
+    std::vector<Bezier> outline; // Closed, consecutive segments.
+};
+
+struct SdfSettings {
+    int pixels_per_em = 32;
+    double range = 4.0; // In pixels, also used as the tile padding.
+    int num_threads = 0; // Zero means one per hardware thread.
+};
+
+struct SdfAtlasEntry {
+    std::string name;
+    int x, y, width, height;     // Tile location in the atlas, pixels.
+    double left, bottom, right, top; // Tile extents in em units.
+};
+
+class SdfAtlas final {
+public:
+    SdfAtlas(const std::vector<SdfGlyph> &glyphs, const SdfSettings &settings);
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+    const std::vector<uint8_t> &get_pixels() const { return pixels; }
+    const std::vector<SdfAtlasEntry> &get_entries() const { return entries; }
+
+    std::string metrics_json() const;
+    bool write(const char *basename) const;
+
+private:
+    void pack();
+
+    SdfSettings settings;
+    int width = 0;
+    int height = 0;
+    std::vector<SdfAtlasEntry> entries;
+    std::vector<uint8_t> pixels;
+};
+
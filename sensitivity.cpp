@@ -0,0 +1,217 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <sensitivity.hpp>
+#include <trace.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+std::vector<Bezier> beziers_of(const std::vector<Point> &points) {
+    std::vector<Bezier> beziers;
+    for(size_t i = 0; i + 3 < points.size(); i += 3) {
+        beziers.emplace_back(points[i], points[i + 1], points[i + 2], points[i + 3]);
+    }
+    return beziers;
+}
+
+std::variant<Glyph, std::string> solve(const Parser &p,
+                                       const ProgramConstants &constants,
+                                       const std::vector<StrokeStart> &starts,
+                                       const OptimizerState &defaults) {
+    Bridge b;
+    b.set_constants(constants);
+    auto error = execute_parsed(p, b);
+    if(error) {
+        return *error;
+    }
+    auto state = defaults.settings();
+    state.starts = starts;
+    optimize_program(state, b);
+    return std::move(b.get_glyph());
+}
+
+bool same_layout(const Glyph &a, const Glyph &b) {
+    if(a.strokes.size() != b.strokes.size()) {
+        return false;
+    }
+    for(size_t i = 0; i < a.strokes.size(); ++i) {
+        if(a.strokes[i].skeleton.structure_key() != b.strokes[i].skeleton.structure_key()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void add_difference(StrokeSensitivity &s, const Stroke &plus, const Stroke &minus, double step) {
+    std::vector<Vector> d;
+    for(int i = 0; i < plus.num_points(); ++i) {
+        d.push_back((plus.get_points()[i] - minus.get_points()[i]) * (1.0 / (2.0 * step)));
+    }
+    s.derivatives.push_back(std::move(d));
+}
+
+void append_points(std::string &json, const char *key, const std::vector<Point> &points) {
+    char buf[128];
+    json += "\"";
+    json += key;
+    json += "\": [";
+    for(size_t i = 0; i < points.size(); ++i) {
+        snprintf(buf, 128, "%s[%.17g, %.17g]", i ? ", " : "", points[i].x(), points[i].y());
+        json += buf;
+    }
+    json += "]";
+}
+
+void append_stroke(std::string &json,
+                   const char *key,
+                   const StrokeSensitivity &s,
+                   const ProgramConstants &constants) {
+    json += "\"";
+    json += key;
+    json += "\": {";
+    append_points(json, "points", s.points);
+    json += ", \"derivatives\": {";
+    char buf[128];
+    for(size_t c = 0; c < constants.size(); ++c) {
+        snprintf(buf, 128, "%s\"%s\": [", c ? ", " : "", constants[c].first.c_str());
+        json += buf;
+        for(size_t i = 0; i < s.derivatives[c].size(); ++i) {
+            const auto &d = s.derivatives[c][i];
+            snprintf(buf, 128, "%s[%.17g, %.17g]", i ? ", " : "", d.x(), d.y());
+            json += buf;
+        }
+        json += "]";
+    }
+    json += "}}";
+}
+
+} // namespace
+
+std::vector<Point> StrokeSensitivity::linearized(const std::vector<double> &deltas) const {
+    std::vector<Point> result(points);
+    for(size_t c = 0; c < deltas.size() && c < derivatives.size(); ++c) {
+        for(size_t i = 0; i < result.size(); ++i) {
+            result[i] = result[i] + derivatives[c][i] * deltas[c];
+        }
+    }
+    return result;
+}
+
+std::vector<std::vector<Bezier>>
+Sensitivity::linearized_contours(const std::vector<double> &deltas) const {
+    std::vector<std::vector<Bezier>> contours;
+    for(const auto &s : strokes) {
+        contours.push_back(closed_outline(beziers_of(s.left.linearized(deltas)),
+                                          beziers_of(s.right.linearized(deltas))));
+    }
+    return contours;
+}
+
+std::string Sensitivity::to_json() const {
+    std::string json("{\n  \"constants\": [");
+    char buf[256];
+    for(size_t c = 0; c < constants.size(); ++c) {
+        snprintf(buf,
+                 256,
+                 "%s{\"name\": \"%s\", \"value\": %.17g, \"step\": %.17g}",
+                 c ? ", " : "",
+                 constants[c].first.c_str(),
+                 constants[c].second,
+                 steps[c]);
+        json += buf;
+    }
+    json += "],\n  \"strokes\": [";
+    for(size_t i = 0; i < strokes.size(); ++i) {
+        json += i ? ",\n    {" : "\n    {";
+        append_stroke(json, "skeleton", strokes[i].skeleton, constants);
+        json += ",\n     ";
+        append_stroke(json, "left", strokes[i].left, constants);
+        json += ",\n     ";
+        append_stroke(json, "right", strokes[i].right, constants);
+        json += "}";
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+std::variant<Sensitivity, std::string> compute_sensitivity(const std::string &program,
+                                                           const std::vector<std::string> &names,
+                                                           const OptimizerState &defaults) {
+    TraceSpan span("compute_sensitivity");
+    Lexer l(program);
+    Parser p(l);
+    if(!p.parse()) {
+        return "Parser fail: " + p.get_error();
+    }
+    Sensitivity result;
+    for(const auto &name : names) {
+        result.constants.emplace_back(name, 0.0);
+    }
+    Bridge b;
+    auto error = execute_parsed(p, b, &result.constants);
+    if(error) {
+        return *error;
+    }
+    auto state = defaults.settings();
+    optimize_program(state, b);
+    const Glyph &optimum = b.get_glyph();
+    std::vector<StrokeStart> starts;
+    for(const auto &s : optimum.strokes) {
+        starts.push_back(StrokeStart{s.skeleton.get_free_variables(),
+                                     s.left.get_free_variables(),
+                                     s.right.get_free_variables()});
+        result.strokes.push_back(ShapeSensitivity{{s.skeleton.get_points(), {}},
+                                                  {s.left.get_points(), {}},
+                                                  {s.right.get_points(), {}}});
+    }
+
+    for(size_t c = 0; c < names.size(); ++c) {
+        // The optimum moves in kinks where the maximum curvature changes
+        // segment. A step of a percent of the value averages over them and
+        // predicts edits of that size better than a smaller one. The floor
+        // only matters for constants that are zero or nearly so.
+        const double step = 1e-2 * std::max(std::abs(result.constants[c].second), 1e-3);
+        result.steps.push_back(step);
+        std::vector<Glyph> moved;
+        for(const double sign : {1.0, -1.0}) {
+            auto constants = result.constants;
+            constants[c].second += sign * step;
+            auto g = solve(p, constants, starts, defaults);
+            if(std::holds_alternative<std::string>(g)) {
+                return std::move(std::get<std::string>(g));
+            }
+            if(!same_layout(optimum, std::get<Glyph>(g))) {
+                return "Changing " + names[c] + " changes the constraint structure.";
+            }
+            moved.push_back(std::move(std::get<Glyph>(g)));
+        }
+        for(size_t i = 0; i < result.strokes.size(); ++i) {
+            const auto &plus = moved[0].strokes[i];
+            const auto &minus = moved[1].strokes[i];
+            auto &s = result.strokes[i];
+            add_difference(s.skeleton, plus.skeleton, minus.skeleton, step);
+            add_difference(s.left, plus.left, minus.left, step);
+            add_difference(s.right, plus.right, minus.right, step);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <optimizer.hpp>
+#include <string>
+#include <variant>
+#include <vector>
+
+// How the optimized points of a glyph move when top-level constants of
+// its program change. The objective is a maximum of curvature and not
+// smooth, so instead of differentiating its optimality conditions every
+// constant is moved a small step both ways and the glyph solved again,
+// starting from the optimum. The derivatives are the central
+// differences of the results.
+
+struct StrokeSensitivity {
+    std::vector<Point> points;
+    std::vector<std::vector<Vector>> derivatives; // Per constant, per point.
+
+    // The points with the constants changed by deltas, to first order.
+    std::vector<Point> linearized(const std::vector<double> &deltas) const;
+};
+
+struct ShapeSensitivity {
+    StrokeSensitivity skeleton;
+    StrokeSensitivity left;
+    StrokeSensitivity right;
+};
+
+struct Sensitivity {
+    ProgramConstants constants; // The values at the optimum.
+    std::vector<double> steps;  // Used for the differences.
+    std::vector<ShapeSensitivity> strokes;
+
+    // One closed contour per stroke with the constants changed by deltas,
+    // to first order. For previews while the change is solved in full.
+    std::vector<std::vector<Bezier>> linearized_contours(const std::vector<double> &deltas) const;
+    std::string to_json() const;
+};
+
+// The state gives the settings to solve with.
+std::variant<Sensitivity, std::string> compute_sensitivity(const std::string &program,
+                                                           const std::vector<std::string> &names,
+                                                           const OptimizerState &defaults);
@@ -0,0 +1,495 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <server.hpp>
+#include <optimizer.hpp>
+#include <svgexporter.hpp>
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+#include <thread>
+#if !defined(_WIN32)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Parsing is the slowest part of handling a small glyph, so programs are
+// kept parsed. Parser refers to its Lexer, so they live together.
+struct CompiledProgram {
+    explicit CompiledProgram(const std::string &text) : lexer(text), parser(lexer) {
+        if(!parser.parse()) {
+            error = "Parser fail: " + parser.get_error();
+        }
+    }
+
+    Lexer lexer;
+    Parser parser;
+    std::string error; // Empty if the program parsed.
+};
+
+namespace {
+
+const size_t max_message_size = 64 * 1024 * 1024;
+
+class WorkerPool final {
+public:
+    explicit WorkerPool(int num_threads) {
+        for(int i = 0; i < num_threads; ++i) {
+            threads.emplace_back([this]() { work(); });
+        }
+    }
+
+    // Runs all queued tasks before returning.
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        for(auto &t : threads) {
+            t.join();
+        }
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        cv.notify_one();
+    }
+
+private:
+    void work() {
+        while(true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if(tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+};
+
+struct RequestOptions {
+    bool variables = false;
+    int deadline_ms = 0;
+    int threads = 1;
+    bool warm = true;
+    bool cache = true;
+};
+
+// A non-negative decimal number that fits an int, otherwise -1.
+int parse_count(const std::string &value) {
+    if(value.empty() || value.size() > 10 ||
+       value.find_first_not_of("0123456789") != std::string::npos) {
+        return -1;
+    }
+    const long long n = strtoll(value.c_str(), nullptr, 10);
+    return n <= std::numeric_limits<int>::max() ? (int)n : -1;
+}
+
+std::optional<std::string> parse_options(const std::string &line, RequestOptions &options) {
+    size_t pos = 0;
+    while(pos < line.size()) {
+        if(line[pos] == ' ') {
+            ++pos;
+            continue;
+        }
+        size_t end = line.find(' ', pos);
+        if(end == std::string::npos) {
+            end = line.size();
+        }
+        const std::string option = line.substr(pos, end - pos);
+        pos = end;
+        const auto eq = option.find('=');
+        if(eq == std::string::npos) {
+            return "Malformed option: " + option;
+        }
+        const std::string key = option.substr(0, eq);
+        const std::string value = option.substr(eq + 1);
+        const int number = parse_count(value);
+        if(key == "output" && (value == "svg" || value == "variables")) {
+            options.variables = value == "variables";
+        } else if(key == "deadline" && number > 0) {
+            options.deadline_ms = number;
+        } else if(key == "threads" && number >= 0) {
+            options.threads = number;
+        } else if(key == "warm" && (value == "0" || value == "1")) {
+            options.warm = value == "1";
+        } else if(key == "cache" && (value == "0" || value == "1")) {
+            options.cache = value == "1";
+        } else {
+            return "Unknown option: " + option;
+        }
+    }
+    return std::optional<std::string>{};
+}
+
+void append_variables(std::string &out, int stroke, const char *part, const Stroke &s) {
+    out += std::to_string(stroke);
+    out += ' ';
+    out += part;
+    char buf[32];
+    for(const double v : s.get_free_variables()) {
+        snprintf(buf, sizeof(buf), " %.17g", v);
+        out += buf;
+    }
+    out += '\n';
+}
+
+} // namespace
+
+bool write_message(FILE *f, const std::string &payload) {
+    if(fprintf(f, "%zu\n", payload.size()) < 0) {
+        return false;
+    }
+    if(fwrite(payload.data(), 1, payload.size(), f) != payload.size()) {
+        return false;
+    }
+    return fflush(f) == 0;
+}
+
+std::optional<std::string> read_message(FILE *f) {
+    size_t size = 0;
+    int c;
+    int digits = 0;
+    while((c = fgetc(f)) != '\n') {
+        if(c < '0' || c > '9' || ++digits > 10) {
+            return std::optional<std::string>();
+        }
+        size = size * 10 + (c - '0');
+    }
+    if(digits == 0 || size > max_message_size) {
+        return std::optional<std::string>();
+    }
+    std::string payload(size, '\0');
+    if(fread(&payload[0], 1, size, f) != size) {
+        return std::optional<std::string>();
+    }
+    return payload;
+}
+
+Server::Server(const ServerSettings &settings_)
+    : settings(settings_), programs(settings_.program_cache_size),
+      results(settings_.result_cache_size), warm_starts(settings_.warm_cache_size),
+      phases(settings_.phase_cache_size) {
+    if(settings.num_workers <= 0) {
+        settings.num_workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+Server::~Server() = default;
+
+std::shared_ptr<const CompiledProgram> Server::compile(const std::string &program) {
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto cached = programs.get(program);
+        if(cached) {
+            return *cached;
+        }
+    }
+    // Two threads may compile the same program, which is harmless.
+    auto compiled = std::make_shared<const CompiledProgram>(program);
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    programs.put(program, compiled);
+    return compiled;
+}
+
+std::string Server::handle(const std::string &request) {
+    const auto started = std::chrono::steady_clock::now();
+    const auto line_end = request.find('\n');
+    const std::string option_line = request.substr(0, line_end);
+    const std::string program =
+        line_end == std::string::npos ? std::string() : request.substr(line_end + 1);
+    RequestOptions options;
+    auto error = parse_options(option_line, options);
+    if(error) {
+        return "error\n" + *error;
+    }
+    // Partial results depend on timing and are never reused.
+    const bool cacheable = options.cache && options.deadline_ms == 0;
+    if(cacheable) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto cached = results.get(request);
+        if(cached) {
+            return *cached;
+        }
+    }
+
+    auto compiled = compile(program);
+    if(!compiled->error.empty()) {
+        return "error\n" + compiled->error;
+    }
+    Bridge b;
+    error = execute_parsed(compiled->parser, b);
+    if(error) {
+        return "error\n" + *error;
+    }
+    auto &glyph = b.get_glyph();
+    std::vector<std::string> keys;
+    for(const auto &shape : glyph.strokes) {
+        keys.push_back(shape.skeleton.structure_key());
+    }
+
+    OptimizerState state;
+    state.verbose = false;
+    state.keep_frames = false;
+    state.num_threads = options.threads;
+    if(options.deadline_ms > 0) {
+        state.deadline = started + std::chrono::milliseconds(options.deadline_ms);
+    }
+    if(options.warm) {
+        state.phase_cache = &phases;
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        for(const auto &key : keys) {
+            auto start = warm_starts.get(key);
+            state.starts.push_back(start ? *start : StrokeStart());
+        }
+    }
+    optimize_program(state, b);
+    if(!state.partial) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        for(size_t i = 0; i < keys.size(); ++i) {
+            const auto &shape = glyph.strokes[i];
+            warm_starts.put(keys[i],
+                            StrokeStart{shape.skeleton.get_free_variables(),
+                                        shape.left.get_free_variables(),
+                                        shape.right.get_free_variables()});
+        }
+    }
+
+    std::string response(state.partial ? "partial\n" : "ok\n");
+    if(options.variables) {
+        for(int i = 0; i < (int)glyph.strokes.size(); ++i) {
+            append_variables(response, i, "skeleton", glyph.strokes[i].skeleton);
+            append_variables(response, i, "left", glyph.strokes[i].left);
+            append_variables(response, i, "right", glyph.strokes[i].right);
+        }
+    } else {
+        response += build_svg(glyph, OptPhase::finished);
+    }
+    if(cacheable && !state.partial) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        results.put(request, response);
+    }
+    return response;
+}
+
+// Requests are handled in parallel but answered in the order they came.
+int run_stdio_server(Server &server) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::future<std::string>> pending;
+    bool reading_done = false;
+    bool write_failed = false;
+    std::thread writer([&]() {
+        while(true) {
+            std::future<std::string> next;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]() { return reading_done || !pending.empty(); });
+                if(pending.empty()) {
+                    return;
+                }
+                next = std::move(pending.front());
+                pending.pop_front();
+            }
+            if(!write_message(stdout, next.get())) {
+                std::lock_guard<std::mutex> lock(mutex);
+                write_failed = true;
+            }
+        }
+    });
+    {
+        WorkerPool pool(server.num_workers());
+        while(auto request = read_message(stdin)) {
+            auto task = std::make_shared<std::packaged_task<std::string()>>(
+                [&server, r = std::move(*request)]() { return server.handle(r); });
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending.push_back(task->get_future());
+            }
+            cv.notify_one();
+            pool.submit([task]() { (*task)(); });
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reading_done = true;
+    }
+    cv.notify_one();
+    writer.join();
+    return write_failed ? 1 : 0;
+}
+
+#if defined(_WIN32)
+
+int run_socket_server(Server &, const char *) {
+    fprintf(stderr, "Unix domain sockets are not supported on this platform.\n");
+    return 1;
+}
+
+#else
+
+namespace {
+
+volatile sig_atomic_t stop_requested = 0;
+
+void request_stop(int) { stop_requested = 1; }
+
+bool fill_address(sockaddr_un &addr, const char *socket_path) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    strcpy(addr.sun_path, socket_path);
+    return true;
+}
+
+FILE *open_duplicate(int fd, const char *mode) {
+    const int copy = dup(fd);
+    if(copy < 0) {
+        return nullptr;
+    }
+    FILE *f = fdopen(copy, mode);
+    if(!f) {
+        close(copy);
+    }
+    return f;
+}
+
+// Does not close fd.
+void serve_connection(Server &server, int fd) {
+    FILE *in = open_duplicate(fd, "r");
+    FILE *out = open_duplicate(fd, "w");
+    if(in && out) {
+        while(auto request = read_message(in)) {
+            if(!write_message(out, server.handle(*request))) {
+                break;
+            }
+        }
+    }
+    if(out) {
+        fclose(out);
+    }
+    if(in) {
+        fclose(in);
+    }
+}
+
+} // namespace
+
+int connect_unix_socket(const char *socket_path) {
+    sockaddr_un addr;
+    if(!fill_address(addr, socket_path)) {
+        return -1;
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    if(connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Every connection is served by one worker at a time; connections beyond
+// the worker count wait for a free one.
+int run_socket_server(Server &server, const char *socket_path) {
+    sockaddr_un addr;
+    if(!fill_address(addr, socket_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return 1;
+    }
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener < 0) {
+        perror("socket");
+        return 1;
+    }
+    unlink(socket_path);
+    if(bind(listener, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        perror(socket_path);
+        close(listener);
+        return 1;
+    }
+    signal(SIGINT, request_stop);
+    signal(SIGTERM, request_stop);
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "Listening on %s with %d workers.\n", socket_path, server.num_workers());
+    std::mutex connections_mutex;
+    std::vector<int> connections;
+    {
+        WorkerPool pool(server.num_workers());
+        while(!stop_requested) {
+            pollfd p{listener, POLLIN, 0};
+            if(poll(&p, 1, 200) <= 0) {
+                continue;
+            }
+            const int fd = accept(listener, nullptr, nullptr);
+            if(fd < 0) {
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(connections_mutex);
+                connections.push_back(fd);
+            }
+            pool.submit([&server, &connections_mutex, &connections, fd]() {
+                serve_connection(server, fd);
+                std::lock_guard<std::mutex> lock(connections_mutex);
+                connections.erase(std::find(connections.begin(), connections.end(), fd));
+                close(fd);
+            });
+        }
+        close(listener);
+        unlink(socket_path);
+        // Wakes up the connections waiting for requests so that the pool
+        // can finish.
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        for(const int fd : connections) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,92 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <optimizer.hpp>
+#include <lrucache.hpp>
+#include <phasecache.hpp>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// A long running fonttoy that answers requests over a Unix domain socket
+// or over stdin and stdout. Every message in either direction is framed
+// as its payload length in decimal, a line feed and the payload.
+//
+// A request payload starts with a line of space separated options:
+//
+//   output=svg|variables  what to return (svg)
+//   deadline=MS           return the best shape so far after MS ms
+//   threads=N             threads for independent strokes (1)
+//   warm=0|1              start from earlier solutions of the same shape
+//                         and reuse phases with unchanged inputs (1)
+//   cache=0|1             reuse responses to identical requests (1)
+//
+// and the rest is the program. The response payload starts with a line
+// of ok, partial or error, followed by the SVG, the variables or the
+// error message. Variables are written one line per stroke and part, as
+// the stroke index, the part name and the values.
+
+bool write_message(FILE *f, const std::string &payload);
+// Empty at end of file or on a malformed frame.
+std::optional<std::string> read_message(FILE *f);
+
+struct ServerSettings {
+    int num_workers = 0; // Zero means one per hardware thread.
+    size_t program_cache_size = 64;
+    size_t result_cache_size = 256;
+    size_t warm_cache_size = 256;
+    size_t phase_cache_size = 1024;
+};
+
+struct CompiledProgram;
+
+class Server final {
+public:
+    explicit Server(const ServerSettings &settings);
+    ~Server();
+
+    // Takes a request payload and returns the response payload. Can be
+    // called from several threads at once.
+    std::string handle(const std::string &request);
+
+    int num_workers() const { return settings.num_workers; }
+
+private:
+    std::shared_ptr<const CompiledProgram> compile(const std::string &program);
+
+    ServerSettings settings;
+    std::mutex cache_mutex;
+    LruCache<std::shared_ptr<const CompiledProgram>> programs;
+    LruCache<std::string> results;
+    // Final variables keyed by Stroke::structure_key of the skeleton.
+    LruCache<StrokeStart> warm_starts;
+    PhaseCache phases; // Has a lock of its own.
+};
+
+// Both return the process exit code.
+int run_stdio_server(Server &server);
+int run_socket_server(Server &server, const char *socket_path);
+
+#if !defined(_WIN32)
+// Returns a connected socket or -1.
+int connect_unix_socket(const char *socket_path);
+#endif
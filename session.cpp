@@ -0,0 +1,75 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <session.hpp>
+#include <chrono>
+
+Session::Session() = default;
+
+Session::~Session() = default;
+
+SessionResult Session::update(const std::string &text, int budget_ms) {
+    const auto start = std::chrono::steady_clock::now();
+    SessionResult result;
+    auto error = program.update(text);
+    if(error) {
+        result.error = "Parser fail: " + *error;
+    }
+    Bridge b;
+    if(!result.error) {
+        result.error = program.execute(&b);
+    }
+    result.front_end = program.get_stats();
+    result.reparsed = result.front_end.lines_lexed > 0;
+    if(result.error) {
+        return result;
+    }
+    if(!b.has_shape()) {
+        result.error = "Program did not define a bezier stroke.";
+        return result;
+    }
+    auto &new_glyph = b.get_glyph();
+    std::vector<std::string> keys;
+    OptimizerState state;
+    state.verbose = false;
+    state.keep_frames = false;
+    state.num_threads = num_threads;
+    state.phase_cache = &phases;
+    if(budget_ms > 0) {
+        state.deadline = start + std::chrono::milliseconds(budget_ms);
+    }
+    for(size_t i = 0; i < new_glyph.strokes.size(); ++i) {
+        keys.push_back(new_glyph.strokes[i].skeleton.structure_key());
+        if(glyph && i < structure_keys.size() && keys[i] == structure_keys[i]) {
+            const auto &old = glyph->strokes[i];
+            state.starts.push_back(StrokeStart{old.skeleton.get_free_variables(),
+                                               old.left.get_free_variables(),
+                                               old.right.get_free_variables()});
+        } else {
+            state.starts.emplace_back();
+        }
+    }
+    optimize_program(state, b);
+    glyph = std::make_unique<Glyph>(std::move(new_glyph));
+    structure_keys = std::move(keys);
+    result.partial = state.partial;
+    result.reused_phases = std::move(state.reused_phases);
+    result.seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <optimizer.hpp>
+#include <frontend.hpp>
+#include <phasecache.hpp>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Keeps a program and its solution between edits, for editors. Only the
+// edited lines are lexed and parsed again, and only the statements that
+// depend on them are evaluated again, see IncrementalProgram. Every
+// solve starts the skeletons from the previous optimum of strokes whose
+// constraint structure did not change, and phases whose inputs did not
+// change at all, such as the skeleton when only the pen was edited, are
+// not solved again.
+
+struct SessionResult {
+    std::optional<std::string> error;
+    bool reparsed = false; // False if at most numbers were patched.
+    FrontEndStats front_end;
+    std::vector<ReusedPhase> reused_phases;
+    bool partial = false;  // The time budget ran out.
+    double seconds = 0;
+};
+
+class Session final {
+public:
+    Session();
+    ~Session();
+
+    // Solves the given program text. Zero budget means no time limit.
+    // Calling this again with the same text continues from a partial
+    // solution.
+    SessionResult update(const std::string &text, int budget_ms = 0);
+
+    // The last successful solution. Undefined before one exists.
+    Glyph &get_glyph() { return *glyph; }
+    bool has_glyph() const { return glyph != nullptr; }
+
+    int num_threads = 1;
+
+private:
+    IncrementalProgram program;
+    PhaseCache phases;
+
+    std::unique_ptr<Glyph> glyph;
+    std::vector<std::string> structure_keys; // Of glyph's strokes.
+};
@@ -0,0 +1,223 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stats.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace {
+
+const int num_counters = (int)StatCounter::num_counters;
+const int num_timers = (int)StatTimer::num_timers;
+
+#if defined(FONTTOY_STATS)
+
+const char *counter_names[num_counters] = {
+    "objective_skeleton",
+    "objective_left",
+    "objective_right",
+    "gradient_evaluations",
+    "tokens",
+    "update_model_calls",
+    "fixed_constraint",
+    "attach_constraint",
+    "free_constraint",
+    "direction_constraint",
+    "mirror_constraint",
+    "smooth_constraint",
+    "angle_constraint",
+    "same_offset_constraint",
+    "reflect_constraint",
+    "bezier_samples",
+    "heap_allocations",
+    "heap_bytes",
+    "svg_frames",
+    "svg_bytes",
+    "bytes_written",
+};
+
+const char *timer_names[num_timers] = {
+    "parse", "interpret", "skeleton", "left", "right", "export"};
+
+#endif
+
+struct StatValues {
+    long long counters[num_counters] = {};
+    long long timer_calls[num_timers] = {};
+    double wall[num_timers] = {};
+    double cpu[num_timers] = {};
+
+    void add(const StatValues &o) {
+        for(int i = 0; i < num_counters; ++i) {
+            counters[i] += o.counters[i];
+        }
+        for(int i = 0; i < num_timers; ++i) {
+            timer_calls[i] += o.timer_calls[i];
+            wall[i] += o.wall[i];
+            cpu[i] += o.cpu[i];
+        }
+    }
+};
+
+struct ThreadStats;
+
+// Values of threads that have exited and the ones still running.
+struct GlobalStats {
+    std::mutex m;
+    StatValues finished;
+    std::vector<ThreadStats *> live;
+};
+
+GlobalStats &global_stats() {
+    static GlobalStats g;
+    return g;
+}
+
+// Updated from operator new, which must not touch thread locals that
+// allocate or need construction on first use. This one is zero
+// initialized statically. Threads that record nothing else are left out.
+struct HeapCounts {
+    long long allocations;
+    long long bytes;
+};
+
+thread_local HeapCounts thread_heap;
+
+struct ThreadStats {
+    StatValues values;
+    const HeapCounts *heap = &thread_heap; // Of the same thread.
+
+    // Values with the allocations so far.
+    StatValues current() const {
+        StatValues v = values;
+        v.counters[(int)StatCounter::heap_allocations] += heap->allocations;
+        v.counters[(int)StatCounter::heap_bytes] += heap->bytes;
+        return v;
+    }
+
+    ThreadStats() {
+        auto &g = global_stats();
+        std::lock_guard<std::mutex> lock(g.m);
+        g.live.push_back(this);
+    }
+
+    ~ThreadStats() {
+        auto &g = global_stats();
+        std::lock_guard<std::mutex> lock(g.m);
+        g.finished.add(current());
+        g.live.erase(std::find(g.live.begin(), g.live.end(), this));
+    }
+};
+
+thread_local ThreadStats thread_stats;
+
+double wall_now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+double cpu_now() {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    return double(std::clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+} // namespace
+
+#if defined(FONTTOY_STATS)
+
+void *operator new(std::size_t size) {
+    ++thread_heap.allocations;
+    thread_heap.bytes += size;
+    if(void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+#endif
+
+void stat_add(StatCounter c, long long amount) { thread_stats.values.counters[(int)c] += amount; }
+
+void stat_add_time(StatTimer t, double wall_seconds, double cpu_seconds) {
+    auto &v = thread_stats.values;
+    ++v.timer_calls[(int)t];
+    v.wall[(int)t] += wall_seconds;
+    v.cpu[(int)t] += cpu_seconds;
+}
+
+StatTimerScope::StatTimerScope(StatTimer t) : timer(t), wall_start(wall_now()), cpu_start(cpu_now()) {}
+
+StatTimerScope::~StatTimerScope() {
+    stat_add_time(timer, wall_now() - wall_start, cpu_now() - cpu_start);
+}
+
+std::string stats_json() {
+#if defined(FONTTOY_STATS)
+    StatValues total;
+    {
+        auto &g = global_stats();
+        std::lock_guard<std::mutex> lock(g.m);
+        total.add(g.finished);
+        for(const auto *t : g.live) {
+            total.add(t->current());
+        }
+    }
+
+    std::string json("{\n  \"enabled\": true,\n  \"counters\": {\n");
+    char buf[256];
+    for(int i = 0; i < num_counters; ++i) {
+        snprintf(buf,
+                 sizeof(buf),
+                 "    \"%s\": %lld%s\n",
+                 counter_names[i],
+                 total.counters[i],
+                 i + 1 < num_counters ? "," : "");
+        json += buf;
+    }
+    json += "  },\n  \"timers\": {\n";
+    for(int i = 0; i < num_timers; ++i) {
+        snprintf(buf,
+                 sizeof(buf),
+                 "    \"%s\": {\"calls\": %lld, \"wall\": %.6f, \"cpu\": %.6f}%s\n",
+                 timer_names[i],
+                 total.timer_calls[i],
+                 total.wall[i],
+                 total.cpu[i],
+                 i + 1 < num_timers ? "," : "");
+        json += buf;
+    }
+    json += "  }\n}\n";
+    return json;
+#else
+    return "{\n  \"enabled\": false\n}\n";
+#endif
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+
+// Counters and timers for the hot paths. They are compiled in with the
+// stats build option (FONTTOY_STATS) and the STAT_ macros expand to
+// nothing otherwise. Counting goes to per thread storage, so parallel
+// optimization does not contend on shared cache lines.
+
+enum class StatCounter : int {
+    objective_skeleton,
+    objective_left,
+    objective_right,
+    gradient_evaluations,
+    tokens,
+    update_model_calls,
+    fixed_constraint,
+    attach_constraint,
+    free_constraint,
+    direction_constraint,
+    mirror_constraint,
+    smooth_constraint,
+    angle_constraint,
+    same_offset_constraint,
+    reflect_constraint,
+    bezier_samples,
+    heap_allocations,
+    heap_bytes,
+    svg_frames,
+    svg_bytes,
+    bytes_written,
+    num_counters,
+};
+
+enum class StatTimer : int {
+    parse, // Includes lexing, tokens are read on demand.
+    interpret,
+    skeleton,
+    left,
+    right,
+    export_output,
+    num_timers,
+};
+
+void stat_add(StatCounter c, long long amount);
+void stat_add_time(StatTimer t, double wall_seconds, double cpu_seconds);
+
+// Measures wall and thread CPU time of its scope.
+class StatTimerScope final {
+public:
+    explicit StatTimerScope(StatTimer t);
+    ~StatTimerScope();
+
+private:
+    StatTimer timer;
+    double wall_start;
+    double cpu_start;
+};
+
+// All counters and timers summed over threads. Times are in seconds and
+// add up across threads, so phases run in parallel can exceed the total
+// run time.
+std::string stats_json();
+
+#if defined(FONTTOY_STATS)
+#define STAT_COUNT(c) stat_add(StatCounter::c, 1)
+#define STAT_COUNT_N(c, n) stat_add(StatCounter::c, (n))
+#define STAT_TIME(t) StatTimerScope stat_timer_##t(StatTimer::t)
+#else
+#define STAT_COUNT(c) ((void)0)
+#define STAT_COUNT_N(c, n) ((void)0)
+#define STAT_TIME(t) ((void)0)
+#endif
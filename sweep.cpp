@@ -0,0 +1,161 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <sweep.hpp>
+#include <stats.hpp>
+#include <trace.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+std::variant<std::vector<SweepPoint>, std::string>
+run_sweep(const std::string &program,
+          const std::vector<SweepAxis> &axes,
+          const OptimizerState &defaults,
+          int num_threads) {
+    TraceSpan span("run_sweep");
+    Lexer l(program);
+    Parser p(l);
+    if(!p.parse()) {
+        return "Parser fail: " + p.get_error();
+    }
+    size_t num_points = 1;
+    for(const auto &a : axes) {
+        num_points *= a.values.size();
+    }
+    std::vector<SweepPoint> points(num_points);
+    for(size_t i = 0; i < num_points; ++i) {
+        size_t rest = i;
+        for(auto a = axes.rbegin(); a != axes.rend(); ++a) {
+            points[i].constants.emplace_back(a->name, a->values[rest % a->values.size()]);
+            rest /= a->values.size();
+        }
+        std::reverse(points[i].constants.begin(), points[i].constants.end());
+    }
+
+    // The parsed program is only read, so all threads share it. Every
+    // point is solved on one thread.
+    std::atomic<size_t> next_point(0);
+    auto worker = [&]() {
+        for(size_t i = next_point++; i < num_points; i = next_point++) {
+            const auto start = std::chrono::steady_clock::now();
+            auto &point = points[i];
+            Bridge b;
+            b.set_constants(point.constants);
+            auto error = execute_parsed(p, b);
+            if(error) {
+                point.result = std::move(*error);
+            } else {
+                auto state = defaults.settings();
+                state.num_threads = 1;
+                optimize_program(state, b);
+                point.result = std::move(b.get_glyph());
+            }
+            point.seconds =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    };
+    if(num_threads <= 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::min(num_threads, (int)num_points);
+    if(num_threads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> threads;
+        for(int i = 0; i < num_threads; ++i) {
+            threads.emplace_back(worker);
+        }
+        for(auto &t : threads) {
+            t.join();
+        }
+    }
+    return points;
+}
+
+std::string contact_sheet_svg(const std::vector<SweepPoint> &points, int columns) {
+    TraceSpan span("contact_sheet_svg");
+    // Em squares of cell pixels, with room for the label below.
+    const double cell = 160;
+    const double label = 16;
+    const int rows = ((int)points.size() + columns - 1) / columns;
+    const int buf_size = 1024;
+    char buf[buf_size];
+    std::string svg;
+    snprintf(buf,
+             buf_size,
+             "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\">\n"
+             "<rect width=\"100%%\" height=\"100%%\" fill=\"white\"/>\n",
+             (int)(columns * cell),
+             (int)(rows * (cell + label)));
+    svg += buf;
+    for(size_t i = 0; i < points.size(); ++i) {
+        const double x0 = (i % columns) * cell;
+        const double y0 = (i / columns) * (cell + label);
+        // The em square with some margin, y up.
+        auto px = [&](const Point &p) { return x0 + cell * (0.1 + 0.8 * p.x()); };
+        auto py = [&](const Point &p) { return y0 + cell * (0.9 - 0.8 * p.y()); };
+        std::string text;
+        for(const auto &[name, value] : points[i].constants) {
+            snprintf(buf, buf_size, "%s%s=%g", text.empty() ? "" : " ", name.c_str(), value);
+            text += buf;
+        }
+        snprintf(buf,
+                 buf_size,
+                 "<text x=\"%f\" y=\"%f\" font-size=\"11\" font-family=\"sans-serif\">%s</text>\n",
+                 x0 + 4,
+                 y0 + cell + label - 4,
+                 text.c_str());
+        svg += buf;
+        if(std::holds_alternative<std::string>(points[i].result)) {
+            snprintf(buf,
+                     buf_size,
+                     "<text x=\"%f\" y=\"%f\" font-size=\"11\" fill=\"red\">failed</text>\n",
+                     x0 + 4,
+                     y0 + cell / 2);
+            svg += buf;
+            continue;
+        }
+        svg += "<path fill=\"black\" d=\"";
+        for(const auto &contour : std::get<Glyph>(points[i].result).build_contours()) {
+            snprintf(buf, buf_size, "M%f %f", px(contour.front().p1()), py(contour.front().p1()));
+            svg += buf;
+            for(const auto &b : contour) {
+                snprintf(buf,
+                         buf_size,
+                         " C%f %f %f %f %f %f",
+                         px(b.c1()),
+                         py(b.c1()),
+                         px(b.c2()),
+                         py(b.c2()),
+                         px(b.p2()),
+                         py(b.p2()));
+                svg += buf;
+            }
+            svg += "Z";
+        }
+        svg += "\"/>\n";
+    }
+    svg += "</svg>\n";
+    STAT_COUNT(svg_frames);
+    STAT_COUNT_N(svg_bytes, svg.size());
+    return svg;
+}
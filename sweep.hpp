@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <optimizer.hpp>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Runs a program over a grid of values of its top-level constants. The
+// program is parsed once and the grid points are solved in parallel.
+
+struct SweepAxis {
+    std::string name;
+    std::vector<double> values;
+};
+
+struct SweepPoint {
+    ProgramConstants constants;
+    std::variant<Glyph, std::string> result; // Or an error message.
+    double seconds = 0;
+};
+
+// All combinations of the axis values, the last axis varying fastest.
+// The state gives the settings to solve every point with. Returns an
+// error message if the program does not parse.
+std::variant<std::vector<SweepPoint>, std::string>
+run_sweep(const std::string &program,
+          const std::vector<SweepAxis> &axes,
+          const OptimizerState &defaults,
+          int num_threads);
+
+// The points side by side in a grid of the given number of columns,
+// each labeled with its constants.
+std::string contact_sheet_svg(const std::vector<SweepPoint> &points, int columns);
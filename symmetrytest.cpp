@@ -0,0 +1,85 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "optimizer.hpp"
+#include <cmath>
+#include <cstdio>
+
+const char *free_middle = "pi2 = pi / 2.0\n"
+                          "Stroke(2)\n"
+                          "PenCircle(0.05)\n"
+                          "FixedConstraint(0, 0.2, 0.8)\n"
+                          "DirectionConstraint(0, 1, 3.0 * pi2)\n"
+                          "FixedConstraint(6, 0.6, 0.8)\n"
+                          "DirectionConstraint(6, 5, 3.0 * pi2)\n";
+
+const char *fixed_middle = "pi2 = pi / 2.0\n"
+                           "Stroke(2)\n"
+                           "PenCircle(0.05)\n"
+                           "FixedConstraint(0, 0.2, 0.8)\n"
+                           "DirectionConstraint(0, 1, 3.0 * pi2)\n"
+                           "FixedConstraint(3, 0.4, 0.2)\n"
+                           "DirectionConstraint(3, 2, pi)\n"
+                           "DirectionConstraint(3, 4, 0.0)\n"
+                           "DirectionConstraint(6, 5, 3.0 * pi2)\n"
+                           "FixedConstraint(6, 0.6, 0.8)\n";
+
+int test_program(const char *name, const char *program, bool symmetric) {
+    OptimizerState state;
+    state.verbose = false;
+    state.keep_frames = false;
+    auto result = calculate_sample_dynamically(state, program);
+    if(std::holds_alternative<std::string>(result)) {
+        printf("%s: %s\n", name, std::get<std::string>(result).c_str());
+        return 1;
+    }
+    const Stroke &s = std::get<Glyph>(result).strokes[0].skeleton;
+    if((s.get_symmetry() != nullptr) != symmetric) {
+        printf("%s: symmetry %s detected.\n", name, symmetric ? "not" : "wrongly");
+        return 1;
+    }
+    if(!symmetric) {
+        return 0;
+    }
+    // Reflected across x = 0.4.
+    const auto &points = s.get_points();
+    const int n = points.size();
+    for(int i = 0; i < n; ++i) {
+        const Point &p = points[i];
+        const Point &q = points[n - 1 - i];
+        if(fabs(p.x() + q.x() - 0.8) > 1e-9 || fabs(p.y() - q.y()) > 1e-9) {
+            printf("%s: points %d and %d are not mirror images.\n", name, i, n - 1 - i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int, char **) {
+    // A middle point that is not fixed on the axis could leave it, so
+    // such strokes are solved in full.
+    int failures = test_program("Free middle point", free_middle, false) +
+                   test_program("Fixed middle point", fixed_middle, true);
+    if(failures) {
+        printf("%d failures.\n", failures);
+        return 1;
+    }
+    printf("All symmetry tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <trace.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+    const char *name;
+    const char *detail;
+    int64_t start; // Nanoseconds since trace_start.
+    int64_t duration;
+};
+
+// Only written by the thread holding it. Grows as spans are recorded,
+// and when full the oldest spans are overwritten and counted as dropped.
+struct TraceBuffer {
+    static const size_t capacity = 1 << 16;
+
+    int thread_id;
+    bool in_use = true;
+    uint64_t num_written = 0;
+    std::vector<TraceEvent> events;
+
+    explicit TraceBuffer(int thread_id) : thread_id(thread_id) {}
+
+    void push(const TraceEvent &e) {
+        if(events.size() < capacity) {
+            events.push_back(e);
+        } else {
+            events[num_written % capacity] = e;
+        }
+        ++num_written;
+    }
+};
+
+std::atomic<bool> enabled(false);
+std::chrono::steady_clock::time_point start_time;
+
+// Buffers outlive their threads so that spans of finished workers can
+// still be written out. A thread that exits hands its buffer on to the
+// next new thread, whose spans then continue on the same track, so
+// servers starting threads over and over keep only as many buffers as
+// they ever had threads running at once.
+std::mutex buffers_mutex;
+std::vector<std::unique_ptr<TraceBuffer>> buffers;
+
+struct BufferLease {
+    TraceBuffer *buffer = nullptr;
+
+    ~BufferLease() {
+        if(buffer) {
+            std::lock_guard<std::mutex> lock(buffers_mutex);
+            buffer->in_use = false;
+        }
+    }
+};
+
+thread_local BufferLease thread_lease;
+
+int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                                start_time)
+        .count();
+}
+
+TraceBuffer *get_thread_buffer() {
+    if(!thread_lease.buffer) {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        auto free_buffer = std::find_if(
+            buffers.begin(), buffers.end(), [](const auto &b) { return !b->in_use; });
+        if(free_buffer != buffers.end()) {
+            (*free_buffer)->in_use = true;
+            thread_lease.buffer = free_buffer->get();
+        } else {
+            buffers.push_back(std::make_unique<TraceBuffer>(buffers.size() + 1));
+            thread_lease.buffer = buffers.back().get();
+        }
+    }
+    return thread_lease.buffer;
+}
+
+void append_json_string(std::string &out, const char *s) {
+    out += '"';
+    for(; *s; ++s) {
+        const unsigned char c = *s;
+        if(c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if(c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+} // namespace
+
+void trace_start() {
+    start_time = std::chrono::steady_clock::now();
+    enabled.store(true, std::memory_order_release);
+}
+
+bool trace_enabled() { return enabled.load(std::memory_order_relaxed); }
+
+TraceSpan::TraceSpan(const char *name, const char *detail) : name(name), detail(detail) {
+    if(trace_enabled()) {
+        start = now();
+    }
+}
+
+TraceSpan::~TraceSpan() {
+    if(start >= 0) {
+        get_thread_buffer()->push(TraceEvent{name, detail, start, now() - start});
+    }
+}
+
+bool trace_write(const char *fname) {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    std::string json("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    char buf[256];
+    bool first = true;
+    for(const auto &b : buffers) {
+        snprintf(buf,
+                 sizeof(buf),
+                 "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                 "\"args\": {\"name\": \"thread %d\"}}",
+                 first ? "" : ",\n",
+                 b->thread_id,
+                 b->thread_id);
+        json += buf;
+        first = false;
+        const uint64_t count = std::min<uint64_t>(b->num_written, TraceBuffer::capacity);
+        for(uint64_t i = b->num_written - count; i < b->num_written; ++i) {
+            const auto &e = b->events[i % TraceBuffer::capacity];
+            json += ",\n{\"name\": ";
+            append_json_string(json, e.name);
+            snprintf(buf,
+                     sizeof(buf),
+                     ", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                     b->thread_id,
+                     e.start / 1000.0,
+                     e.duration / 1000.0);
+            json += buf;
+            if(e.detail) {
+                json += ", \"args\": {\"detail\": ";
+                append_json_string(json, e.detail);
+                json += '}';
+            }
+            json += '}';
+        }
+        if(b->num_written > count) {
+            snprintf(buf,
+                     sizeof(buf),
+                     ",\n{\"name\": \"dropped %llu spans\", \"ph\": \"i\", \"s\": \"t\", "
+                     "\"pid\": 1, \"tid\": %d, \"ts\": 0}",
+                     (unsigned long long)(b->num_written - count),
+                     b->thread_id);
+            json += buf;
+        }
+    }
+    json += "\n]}\n";
+    FILE *f = fopen(fname, "w");
+    if(!f) {
+        return false;
+    }
+    const bool ok = fwrite(json.data(), 1, json.size(), f) == json.size();
+    fclose(f);
+    return ok;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+/*
+  Copyright (C) 2019 Jussi Pakkanen
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdint>
+
+// Timeline tracing in the Chrome trace event format, viewable in
+// chrome://tracing or Perfetto. Every thread records into its own ring
+// buffer, so recording takes no locks. When tracing is off a span costs
+// one relaxed atomic load.
+
+void trace_start();
+bool trace_enabled();
+
+// Writes all recorded spans. Call only when no other thread is
+// recording, e.g. after the worker threads have been joined.
+bool trace_write(const char *fname);
+
+class TraceSpan final {
+public:
+    // Both strings must outlive the trace, string literals or argv.
+    explicit TraceSpan(const char *name, const char *detail = nullptr);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *name;
+    const char *detail;
+    int64_t start = -1; // Negative when not recording.
+};